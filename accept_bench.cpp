@@ -0,0 +1,286 @@
+/******************************************************************************
+* Program:
+*    accept_bench - connect storm benchmark for the server's Listener
+* Summary:
+*    Starts a Listener on the loopback, then has a bunch of threads connect()
+*    to it as fast as they can (connect, close, repeat). Meanwhile the main
+*    thread runs the same poll() + acceptAll() loop as the server, and reports
+*    how many connections per second it accepted.
+*    Use -s to accept only one connection per wakeup, and -b 1 for the old
+*    backlog, to compare against what the server used to do.
+*    That only times accept(). With -p PORT the threads log in to a running
+*    server instead, the whole way a client does: connect, NAME, name, then
+*    a LIST whose answer shows the player made it to the lobby. That times
+*    the server's real path: accept, admission, the NAME handshake and the
+*    registry.
+******************************************************************************/
+#include <atomic>
+#include <cerrno>   // errno
+#include <cstdlib>  // atoi
+#include <algorithm> // sort
+#include <cstring>  // memset, strcmp
+#include <mutex>
+#include <iostream> // cout
+#include <netinet/in.h> // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <arpa/inet.h>  // inet_pton
+#include <netdb.h>  // getaddrinfo
+#include <poll.h>   // poll
+#include <string>
+#include <sys/socket.h> // socket, connect, accept
+#include <thread>
+#include <unistd.h> // close, getopt
+#include <vector>
+
+#include "constants.h"
+#include "helpers.h"
+#include "listener.h"
+
+using namespace std;
+
+static atomic<int> connected(0); // connect() calls that succeeded
+static atomic<int> failed(0);    // connect() calls that failed
+static atomic<long long> slowest(0); // longest connect() in ms
+static atomic<int> busy(0);      // logins the server turned away
+
+static mutex timesLock;
+static vector<long long> loginTimes; // us from connect() to the LIST answer
+
+/******************************************************************************
+* storm() - connects to the port count times, as fast as it can
+******************************************************************************/
+static void storm(int port, int count)
+{
+   struct sockaddr_in address;
+   memset(&address, 0, sizeof(address));
+   address.sin_family = AF_INET;
+   address.sin_port = htons(port);
+   inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+   for (int i = 0; i < count; i++)
+   {
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+      long long start = now_ms();
+      if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == ERROR_OK)
+         connected++;
+      else
+         failed++;
+
+      // a SYN dropped by a full backlog shows up as a ~1s connect()
+      long long took = now_ms() - start;
+      long long seen = slowest.load();
+      while (took > seen && !slowest.compare_exchange_weak(seen, took))
+         ;
+      close(fd);
+   }
+}
+
+/******************************************************************************
+* login() - logs in to the server on the connected socket as a lobby player,
+*           and asks for the LIST. Returns ERROR_OK once the whole answer is
+*           in, ERROR_BAD if the server hung up (busy is set if it said so).
+******************************************************************************/
+static int login(int fd, const string& name, bool& isBusy)
+{
+   char buffer[MAXLEN];
+   isBusy = false;
+
+   if (read_data(fd, buffer) == ERROR_BAD)
+      return ERROR_BAD;
+   if (strcmp(buffer, SERVER_BUSY) == 0)
+   {
+      isBusy = true;
+      return ERROR_BAD;
+   }
+
+   // LOBBY, so the server doesn't start games between the bench's players.
+   // The name is acknowledged (NAMED, then the name it got)
+   if (write_data(fd, LOBBY) == ERROR_BAD ||
+       read_data(fd, buffer) == ERROR_BAD ||
+       write_data(fd, (char*)name.c_str()) == ERROR_BAD ||
+       read_data(fd, buffer) == ERROR_BAD ||
+       read_data(fd, buffer) == ERROR_BAD ||
+       write_data(fd, LIST_IDLE) == ERROR_BAD ||
+       read_data(fd, buffer) == ERROR_BAD)
+      return ERROR_BAD;
+
+   // the names, then an empty frame
+   do
+   {
+      if (read_data(fd, buffer) == ERROR_BAD)
+         return ERROR_BAD;
+   } while (buffer[0] != '\0');
+   return ERROR_OK;
+}
+
+/******************************************************************************
+* loginStorm() - logs in to the server count times, as fast as it can
+******************************************************************************/
+static void loginStorm(const struct addrinfo* server, int id, int count)
+{
+   vector<long long> times;
+   for (int i = 0; i < count; i++)
+   {
+      // the name and the LIST go out back to back: don't let Nagle hold
+      // the LIST until the server's delayed ACK
+      int fd = socket(server->ai_family, SOCK_STREAM, 0);
+      int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      long long start = now_us();
+      bool isBusy = false;
+      if (connect(fd, server->ai_addr, server->ai_addrlen) == ERROR_OK &&
+          login(fd, "bench" + to_string(id) + "-" + to_string(i),
+                isBusy) == ERROR_OK)
+      {
+         times.push_back(now_us() - start);
+         connected++;
+      }
+      else if (isBusy)
+         busy++;
+      else
+         failed++;
+      close(fd);
+   }
+
+   lock_guard<mutex> guard(timesLock);
+   loginTimes.insert(loginTimes.end(), times.begin(), times.end());
+}
+
+/******************************************************************************
+* benchServer() - the login storm against a running server
+******************************************************************************/
+static int benchServer(const char* host, const char* port, int threads,
+                       int connects)
+{
+   struct addrinfo hints;
+   struct addrinfo* server = NULL;
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   int error = getaddrinfo(host, port, &hints, &server);
+   if (error != ERROR_OK)
+   {
+      cout << "can't resolve " << host << ": " << gai_strerror(error) << "\n";
+      return ERROR_BAD;
+   }
+
+   long long start = now_ms();
+   vector<thread> stormers;
+   for (int i = 0; i < threads; i++)
+      stormers.push_back(thread(loginStorm, server, i, connects));
+   for (size_t i = 0; i < stormers.size(); i++)
+      stormers[i].join();
+   long long elapsed = now_ms() - start;
+   freeaddrinfo(server);
+
+   int done = connected.load();
+   sort(loginTimes.begin(), loginTimes.end());
+   cout << threads << " threads x " << connects << " logins to " << host
+        << ":" << port << "\n"
+        << "logged in: " << done << " in " << elapsed << " ms ("
+        << (elapsed ? done * 1000LL / elapsed : done) << " logins/s)\n"
+        << "busy:      " << busy.load() << "\n"
+        << "failed:    " << failed.load() << "\n";
+   if (done)
+   {
+      cout << "login (us): p50 " << loginTimes[done / 2]
+           << "  p99 " << loginTimes[(done - 1) * 99 / 100]
+           << "  max " << loginTimes[done - 1] << "\n";
+   }
+   return ERROR_OK;
+}
+
+/******************************************************************************
+* MAIN
+* argv: [-b backlog] [-c connecting_threads] [-n connects_per_thread] [-s]
+*       [-p port [-h host]]
+******************************************************************************/
+int main(int argc, char** argv)
+{
+   int backlog = DEFAULT_BACKLOG;
+   int threads = 4;
+   int connects = 500;
+   bool single = false;
+   const char* host = "localhost";
+   const char* serverPort = NULL;
+   int option;
+
+   while ((option = getopt(argc, argv, "b:c:n:sh:p:")) != -1)
+   {
+      if (option == 'b')
+         backlog = atoi(optarg);
+      else if (option == 'c')
+         threads = atoi(optarg);
+      else if (option == 'n')
+         connects = atoi(optarg);
+      else if (option == 's')
+         single = true;
+      else if (option == 'h')
+         host = optarg;
+      else if (option == 'p')
+         serverPort = optarg;
+      else
+      {
+         cout << "Usage: " << argv[0]
+              << " [-b BACKLOG] [-c THREADS] [-n CONNECTS_EACH] [-s]"
+                 " [-p PORT [-h HOST]]\n";
+         return ERROR_BAD;
+      }
+   }
+
+   if (serverPort)
+      return benchServer(host, serverPort, threads, connects);
+
+   Listener listener(backlog);
+   listener.add("127.0.0.1:0"); // any free port
+   int listenFD = listener.getFDs().front();
+   int port = listener.getPort(listenFD);
+
+   int total = threads * connects;
+   int accepted = 0;
+   long long start = now_ms();
+
+   vector<thread> stormers;
+   for (int i = 0; i < threads; i++)
+      stormers.push_back(thread(storm, port, connects));
+
+   struct pollfd welcome;
+   welcome.fd = listenFD;
+   welcome.events = POLLIN;
+   while (accepted + failed.load() < total)
+   {
+      welcome.revents = 0;
+      if (poll(&welcome, 1, 100) <= 0)
+         continue;
+
+      vector<Accepted> clients;
+      if (single)
+      {
+         // what the server used to do: one accept() per wakeup
+         Accepted client;
+         client.fd = accept(listenFD, NULL, NULL);
+         if (client.fd != ERROR_BAD)
+            clients.push_back(client);
+      }
+      else
+         listener.acceptAll(listenFD, clients);
+
+      accepted += clients.size();
+      for (size_t i = 0; i < clients.size(); i++)
+         close(clients[i].fd);
+   }
+   long long elapsed = now_ms() - start;
+
+   for (size_t i = 0; i < stormers.size(); i++)
+      stormers[i].join();
+
+   cout << "backlog " << backlog << ", " << threads << " threads x "
+        << connects << " connects, " << (single ? "one accept" : "acceptAll")
+        << " per wakeup\n"
+        << "accepted:  " << accepted << " in " << elapsed << " ms ("
+        << (elapsed ? accepted * 1000LL / elapsed : accepted) << " conn/s)\n"
+        << "failed:    " << failed.load() << "\n"
+        << "slowest connect(): " << slowest.load() << " ms\n";
+
+   return 0;
+}
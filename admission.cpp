@@ -0,0 +1,103 @@
+#include <netinet/in.h> // sockaddr_in, sockaddr_in6
+#include "admission.h"
+
+using namespace std;
+
+const size_t SWEEP_SIZE = 1024; // buckets kept before full ones are dropped
+
+/******************************************************************************
+* Admission constructor
+******************************************************************************/
+Admission::Admission(int maxConnections, int ipRate, int ipBurst,
+                     int maxWaiting, long long (*clock)())
+   : maxConnections(maxConnections), ipRate(ipRate), ipBurst(ipBurst),
+     maxWaiting(maxWaiting), lastSweep(0), clock(clock)
+{
+}
+
+/******************************************************************************
+* admit() - returns ADMITTED, or which limit the new connection hit. The
+*           cheapest checks go first.
+******************************************************************************/
+int Admission::admit(const struct sockaddr_storage& peer, int connections,
+                     int waiting)
+{
+   if (maxConnections && connections >= maxConnections)
+      return SHED_FULL;
+   if (maxWaiting && waiting >= maxWaiting)
+      return SHED_WAITING;
+   if (ipRate && !takeToken(peer))
+      return SHED_RATE;
+   return ADMITTED;
+}
+
+/******************************************************************************
+* takeToken() - refills the bucket of the peer's IP address, then takes a
+*               token out of it. False if it was empty.
+******************************************************************************/
+bool Admission::takeToken(const struct sockaddr_storage& peer)
+{
+   string key;
+   if (peer.ss_family == AF_INET)
+   {
+      const struct sockaddr_in* v4 = (const struct sockaddr_in*)&peer;
+      key.assign((const char*)&v4->sin_addr, sizeof(v4->sin_addr));
+   }
+   else if (peer.ss_family == AF_INET6)
+   {
+      // an IPv4 client on the dual stack socket shares the IPv4 bucket
+      const struct sockaddr_in6* v6 = (const struct sockaddr_in6*)&peer;
+      if (IN6_IS_ADDR_V4MAPPED(&v6->sin6_addr))
+         key.assign((const char*)&v6->sin6_addr + 12, 4);
+      else
+         key.assign((const char*)&v6->sin6_addr, sizeof(v6->sin6_addr));
+   }
+   else
+      return true; // a local client
+
+   long long now = clock();
+   sweep(now);
+
+   unordered_map<string, Bucket>::iterator it = buckets.find(key);
+   if (it == buckets.end())
+   {
+      Bucket bucket;
+      bucket.tokens = ipBurst;
+      bucket.updated = now;
+      it = buckets.insert(make_pair(key, bucket)).first;
+   }
+
+   Bucket& bucket = it->second;
+   bucket.tokens += (now - bucket.updated) * ipRate / 1000.0;
+   if (bucket.tokens > ipBurst)
+      bucket.tokens = ipBurst;
+   bucket.updated = now;
+
+   if (bucket.tokens < 1)
+      return false;
+   bucket.tokens--;
+   return true;
+}
+
+/******************************************************************************
+* sweep() - a flood from many addresses must not grow the buckets forever.
+*           Once there are many, drop the ones that refilled: a new bucket
+*           starts full anyway. At most once a second.
+******************************************************************************/
+void Admission::sweep(long long now)
+{
+   if (buckets.size() < SWEEP_SIZE || now - lastSweep < 1000)
+      return;
+
+   lastSweep = now;
+   for (unordered_map<string, Bucket>::iterator it = buckets.begin();
+        it != buckets.end(); )
+   {
+      double tokens = it->second.tokens +
+                      (now - it->second.updated) * ipRate / 1000.0;
+      if (tokens >= ipBurst)
+         it = buckets.erase(it);
+      else
+         ++it;
+   }
+}
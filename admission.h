@@ -0,0 +1,47 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <string>
+#include <sys/socket.h> // sockaddr_storage
+#include <unordered_map>
+#include "helpers.h" // now_ms
+
+/******************************************************************************
+* Admission Class - decides, right after accept(), whether the server takes a
+*   new connection. The limits, any of them 0 for no limit:
+*   - maxConnections: connections held by the server and its games
+*   - ipRate: new connections per second from one IP address (token bucket,
+*             holding up to ipBurst tokens). Local clients are exempt.
+*   - maxWaiting: players waiting to be paired
+*   Time is whatever its clock says, now_ms() unless a test gives another.
+******************************************************************************/
+enum admissions { ADMITTED, SHED_FULL, SHED_RATE, SHED_WAITING };
+
+class Admission
+{
+   public:
+      Admission(int maxConnections, int ipRate, int ipBurst, int maxWaiting,
+                long long (*clock)() = now_ms);
+      int admit(const struct sockaddr_storage& peer, int connections,
+                int waiting);
+
+   private:
+      struct Bucket
+      {
+         double tokens;
+         long long updated; // clock() of the last refill
+      };
+
+      int maxConnections;
+      int ipRate;
+      int ipBurst;
+      int maxWaiting;
+      std::unordered_map<std::string, Bucket> buckets; // by raw IP address
+      long long lastSweep;
+      long long (*clock)(); // ms
+
+      bool takeToken(const struct sockaddr_storage& peer);
+      void sweep(long long now);
+};
+
+#endif
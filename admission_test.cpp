@@ -0,0 +1,147 @@
+#include <arpa/inet.h> // inet_pton
+#include <cstdio>   // printf
+#include <cstring>  // memset
+#include <netinet/in.h> // sockaddr_in, sockaddr_in6
+#include "admission.h"
+
+// the Admission's clock in these cases, in ms
+static long long fakeNow = 0;
+
+/******************************************************************************
+* fakeClock() - what the cases set the time to
+******************************************************************************/
+static long long fakeClock()
+{
+   return fakeNow;
+}
+
+/******************************************************************************
+* check() - reports a check of a case
+******************************************************************************/
+static bool check(const char* what, bool passed)
+{
+   printf("%-52s %s\n", what, passed ? "ok" : "FAILED");
+   return passed;
+}
+
+/******************************************************************************
+* address() - the peer address of a client: IPv4 or IPv6 by the text's form
+******************************************************************************/
+static struct sockaddr_storage address(const char* text)
+{
+   struct sockaddr_storage peer;
+   memset(&peer, 0, sizeof(peer));
+   struct sockaddr_in* v4 = (struct sockaddr_in*)&peer;
+   struct sockaddr_in6* v6 = (struct sockaddr_in6*)&peer;
+   if (inet_pton(AF_INET, text, &v4->sin_addr) == 1)
+      peer.ss_family = AF_INET;
+   else if (inet_pton(AF_INET6, text, &v6->sin6_addr) == 1)
+      peer.ss_family = AF_INET6;
+   else
+      peer.ss_family = AF_UNIX;
+   return peer;
+}
+
+/******************************************************************************
+* admitted() - how many of count connections in a row from the peer get in
+******************************************************************************/
+static int admitted(Admission& admission, const char* peer, int count)
+{
+   int in = 0;
+   for (int i = 0; i < count; i++)
+      in += (admission.admit(address(peer), 0, 0) == ADMITTED);
+   return in;
+}
+
+/******************************************************************************
+* testBucket() - an IP may connect in a burst, then at its rate: the bucket
+*                refills with time, up to the burst and no further
+******************************************************************************/
+static bool testBucket()
+{
+   fakeNow = 0;
+   Admission admission(0, 2, 4, 0, fakeClock); // 2 per second, bursts of 4
+
+   bool passed = check("bucket: a burst gets in, then no more",
+                       admitted(admission, "10.0.0.1", 10) == 4);
+   fakeNow = 499;
+   passed &= check("bucket: no token before its time",
+                   admitted(admission, "10.0.0.1", 1) == 0);
+   fakeNow = 500;
+   passed &= check("bucket: a token every 1 / rate seconds",
+                   admitted(admission, "10.0.0.1", 10) == 1);
+   fakeNow = 1500;
+   passed &= check("bucket: refills at the rate",
+                   admitted(admission, "10.0.0.1", 10) == 2);
+   fakeNow = 60000;
+   passed &= check("bucket: never refills past the burst",
+                   admitted(admission, "10.0.0.1", 10) == 4);
+   passed &= check("bucket: another IP has a bucket of its own",
+                   admitted(admission, "10.0.0.2", 10) == 4);
+   return passed;
+}
+
+/******************************************************************************
+* testAddresses() - an IPv4 client on the dual stack socket (v4-mapped) is
+*                   the same client as on the IPv4 socket. A local client is
+*                   never rate limited.
+******************************************************************************/
+static bool testAddresses()
+{
+   fakeNow = 0;
+   Admission admission(0, 1, 3, 0, fakeClock);
+
+   bool passed = (admitted(admission, "192.0.2.7", 2) == 2);
+   passed &= check("addresses: v4-mapped shares the IPv4 bucket",
+                   admitted(admission, "::ffff:192.0.2.7", 10) == 1);
+   passed &= check("addresses: IPv6 has buckets of its own",
+                   admitted(admission, "2001:db8::7", 10) == 3 &&
+                   admitted(admission, "2001:db8::8", 10) == 3);
+   passed &= check("addresses: a local client is exempt",
+                   admitted(admission, "unix", 1000) == 1000);
+   return passed;
+}
+
+/******************************************************************************
+* testCaps() - the server's caps, checked before the rate: 0 is no cap
+******************************************************************************/
+static bool testCaps()
+{
+   fakeNow = 0;
+   Admission capped(10, 0, 0, 3, fakeClock);
+   struct sockaddr_storage peer = address("10.0.0.1");
+
+   bool passed = check("caps: under both caps, admitted",
+                       capped.admit(peer, 9, 2) == ADMITTED);
+   passed &= check("caps: full on connections",
+                   capped.admit(peer, 10, 0) == SHED_FULL);
+   passed &= check("caps: full on waiting players",
+                   capped.admit(peer, 0, 3) == SHED_WAITING);
+   passed &= check("caps: connections are checked first",
+                   capped.admit(peer, 10, 3) == SHED_FULL);
+
+   Admission open(0, 0, 0, 0, fakeClock);
+   passed &= check("caps: no caps, no limit",
+                   open.admit(peer, 1000000, 1000000) == ADMITTED &&
+                   admitted(open, "10.0.0.1", 1000) == 1000);
+
+   // a connection turned away for the caps does not spend a token
+   Admission both(1, 1, 1, 0, fakeClock);
+   both.admit(peer, 1, 0);
+   passed &= check("caps: a capped connection spends no token",
+                   both.admit(peer, 0, 0) == ADMITTED &&
+                   both.admit(peer, 0, 0) == SHED_RATE);
+   return passed;
+}
+
+/******************************************************************************
+* main - admission control, on a clock the cases move by hand
+******************************************************************************/
+int main()
+{
+   bool passed = true;
+   passed &= testBucket();
+   passed &= testAddresses();
+   passed &= testCaps();
+   return (passed ? 0 : 1);
+}
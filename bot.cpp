@@ -0,0 +1,95 @@
+#include <cstdlib>  // rand
+#include "bot.h"
+#include "constants.h" // ROCK, PAPER, SCISSOR
+
+// the moves, in the order used to index the tables
+static const char MOVES[3] = { ROCK, PAPER, SCISSOR };
+
+/******************************************************************************
+* Bot constructor - starts with no knowledge about the opponent
+******************************************************************************/
+Bot::Bot() : lastMove(-1)
+{
+   for (int i = 0; i < 3; i++)
+   {
+      frequency[i] = 0;
+      for (int j = 0; j < 3; j++)
+         transitions[i][j] = 0;
+   }
+}
+
+/******************************************************************************
+* choose() - returns the move that beats the predicted move of the opponent.
+*            Every now and then it plays randomly, so that it can't be farmed
+*            by a player that figured out the prediction.
+******************************************************************************/
+char Bot::choose()
+{
+   if (rand() % 10 == 0)
+      return MOVES[rand() % 3];
+
+   return beats(predict());
+}
+
+/******************************************************************************
+* observe() - updates the tables with the opponent's move ~ O(1)
+******************************************************************************/
+void Bot::observe(char opponentChoice)
+{
+   int move = toIndex(opponentChoice);
+   if (move < 0)
+      return;
+
+   frequency[move]++;
+   if (lastMove >= 0)
+      transitions[lastMove][move]++;
+   lastMove = move;
+}
+
+/******************************************************************************
+* predict() - returns the index of the most likely next move. Uses the Markov
+*             chain row of the last move, and falls back to the overall
+*             frequency while that row has no data yet. Ties are broken
+*             uniformly at random.
+******************************************************************************/
+int Bot::predict()
+{
+   const int* counts = frequency;
+   if (lastMove >= 0 && (transitions[lastMove][0] + transitions[lastMove][1] +
+                         transitions[lastMove][2]) > 0)
+      counts = transitions[lastMove];
+
+   // every move that shares the highest count is an equally good guess
+   int tied[3];
+   int n = 0;
+   for (int i = 0; i < 3; i++)
+   {
+      if (n > 0 && counts[i] > counts[tied[0]])
+         n = 0;
+      if (n == 0 || counts[i] == counts[tied[0]])
+         tied[n++] = i;
+   }
+   return tied[rand() % n];
+}
+
+/******************************************************************************
+* toIndex() - 'r' -> 0, 'p' -> 1, 's' -> 2, anything else -> -1
+******************************************************************************/
+int Bot::toIndex(char choice)
+{
+   for (int i = 0; i < 3; i++)
+   {
+      if (MOVES[i] == choice)
+         return i;
+   }
+   return -1;
+}
+
+/******************************************************************************
+* beats() - returns the move that beats the move at the given index
+******************************************************************************/
+char Bot::beats(int index)
+{
+   // ROCK is beaten by PAPER, PAPER by SCISSOR, SCISSOR by ROCK
+   return MOVES[(index + 1) % 3];
+}
@@ -0,0 +1,26 @@
+#ifndef BOT_H
+#define BOT_H
+
+/******************************************************************************
+* Bot Class - the server side opponent. Predicts the opponent's next move with
+*             a first order Markov chain over the opponent's previous moves,
+*             then plays whatever beats that prediction.
+******************************************************************************/
+class Bot
+{
+   public:
+      Bot();
+      char choose();                     // pick the bot's move for the round
+      void observe(char opponentChoice); // learn from the opponent's move
+
+   private:
+      int transitions[3][3]; // [previous move][next move] counts
+      int frequency[3];      // how many times each move was played
+      int lastMove;          // index of the opponent's last move, -1 if none
+
+      int predict();
+      int toIndex(char choice);
+      char beats(int index);
+};
+
+#endif
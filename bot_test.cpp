@@ -0,0 +1,115 @@
+#include <cstdio>   // printf
+#include <cstdlib>  // srand, abs
+#include "bot.h"
+#include "constants.h" // ROCK, PAPER, SCISSOR
+
+// calls per case, and how far from an even split a tied count may land
+static const int CALLS = 300000;
+static const double TOLERANCE = 0.02;
+
+// rounds a fixed pattern may take to be learned, the rounds played after
+// that, and the share of them the bot must win: it plays randomly 1 round in
+// 10, and still wins a third of those
+static const int LEARNING_ROUNDS = 5;
+static const int ROUNDS = 3000;
+static const double MIN_WINS = 0.9;
+
+/******************************************************************************
+* countChoices() - trains a bot on the given opponent moves, then counts which
+*                  move it picks over many calls
+******************************************************************************/
+static void countChoices(const char* history, int counts[3])
+{
+   Bot bot;
+   for (const char* move = history; *move; move++)
+      bot.observe(*move);
+
+   counts[0] = counts[1] = counts[2] = 0;
+   for (int i = 0; i < CALLS; i++)
+   {
+      char choice = bot.choose();
+      if (choice == ROCK)         counts[0]++;
+      else if (choice == PAPER)   counts[1]++;
+      else if (choice == SCISSOR) counts[2]++;
+   }
+}
+
+/******************************************************************************
+* checkEven() - the moves that answer the tied predictions must come up about
+*               as often as each other
+******************************************************************************/
+static bool checkEven(const char* name, const char* history,
+                      int first, int second)
+{
+   int counts[3];
+   countChoices(history, counts);
+
+   double gap = (double)abs(counts[first] - counts[second]) / CALLS;
+   bool passed = (gap <= TOLERANCE);
+   printf("%-28s r=%6d p=%6d s=%6d gap=%.4f %s\n", name, counts[0],
+          counts[1], counts[2], gap, passed ? "ok" : "FAILED");
+   return passed;
+}
+
+/******************************************************************************
+* checkLearns() - plays the bot against an opponent that repeats the pattern
+*                 forever. Once it saw the pattern for LEARNING_ROUNDS, the
+*                 bot must answer nearly every move with the one beating it.
+******************************************************************************/
+static bool checkLearns(const char* name, const char* pattern)
+{
+   Bot bot;
+   int length = 0;
+   while (pattern[length])
+      length++;
+
+   int wins = 0;
+   for (int round = 0; round < LEARNING_ROUNDS + ROUNDS; round++)
+   {
+      char move = pattern[round % length];
+      char choice = bot.choose();
+      bot.observe(move);
+
+      bool won = (move == ROCK && choice == PAPER) ||
+                 (move == PAPER && choice == SCISSOR) ||
+                 (move == SCISSOR && choice == ROCK);
+      if (round >= LEARNING_ROUNDS && won)
+         wins++;
+   }
+
+   double share = (double)wins / ROUNDS;
+   bool passed = (share >= MIN_WINS);
+   printf("%-28s won %4d of %4d (%.3f) %s\n", name, wins, ROUNDS, share,
+          passed ? "ok" : "FAILED");
+   return passed;
+}
+
+/******************************************************************************
+* main - the bot's tie-break among the most likely next moves is uniform, and
+*        it learns to beat a player that repeats itself
+******************************************************************************/
+int main()
+{
+   srand(1);
+   bool passed = true;
+
+   // no data at all: a 3 way tie, answered by any move
+   passed &= checkEven("no history (r vs p)", "", 0, 1);
+   passed &= checkEven("no history (p vs s)", "", 1, 2);
+
+   // the last move's row is empty, so the frequencies are tied 2 ways:
+   // ROCK and PAPER are answered by PAPER and SCISSOR
+   passed &= checkEven("rock/paper tied", "rp", 1, 2);
+   // PAPER and SCISSOR are answered by SCISSOR and ROCK
+   passed &= checkEven("paper/scissor tied", "ps", 2, 0);
+   // ROCK and SCISSOR are answered by PAPER and ROCK
+   passed &= checkEven("rock/scissor tied", "sr", 1, 0);
+
+   // each move follows from the last one alone: the Markov chain learns
+   // the pattern in one pass of it
+   passed &= checkLearns("all rock", "r");
+   passed &= checkLearns("cycle r -> p -> s", "rps");
+   passed &= checkLearns("cycle r -> s -> p", "rsp");
+
+   return (passed ? 0 : 1);
+}
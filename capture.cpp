@@ -0,0 +1,176 @@
+#include <cstdlib>  // atexit
+#include <cstring>  // memcpy
+#include <fcntl.h>  // open
+#include <unistd.h> // write, read, close
+#include "capture.h"
+#include "constants.h" // ERROR_BAD, ERROR_OK
+#include "helpers.h"   // now_us
+
+using namespace std;
+
+static const char MAGIC[8] = "RPSCAP1";
+static const int HEADER_SIZE = 14;         // of a record, before its frame
+static const size_t FLUSH_SIZE = 64 * 1024; // don't buffer more than this
+
+static int captureFD = ERROR_BAD;
+static std::string capturePath;
+static std::string buffered; // records not written yet
+static std::vector<int> ids; // by fd, 0 = none
+static int lastID = 0;
+
+/******************************************************************************
+* flushAtExit() - a game process exits once its game is over
+******************************************************************************/
+static void flushAtExit()
+{
+   capture_flush();
+}
+
+/******************************************************************************
+* capture_start() - starts capturing to the file at path (emptied first)
+******************************************************************************/
+int capture_start(const char* path)
+{
+   // O_APPEND: each process's writes land whole at the end of the file
+   captureFD = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+   if (captureFD == ERROR_BAD)
+      return ERROR_BAD;
+
+   capturePath = path;
+   buffered.assign(MAGIC, sizeof(MAGIC));
+   atexit(flushAtExit);
+   return capture_flush();
+}
+
+/******************************************************************************
+* capture_reset() - for a child process that closed every fd it inherited:
+*                   opens the capture again, and forgets the connections
+******************************************************************************/
+void capture_reset()
+{
+   if (captureFD == ERROR_BAD)
+      return;
+   captureFD = open(capturePath.c_str(), O_WRONLY | O_APPEND);
+   buffered.clear();
+   ids.clear();
+}
+
+/******************************************************************************
+* capture_open() - records a connection that was just accepted
+******************************************************************************/
+void capture_open(int fd)
+{
+   if (captureFD == ERROR_BAD)
+      return;
+   capture_adopt(fd, ++lastID);
+   capture_frame(fd, CAPTURE_OPEN, "", 0);
+}
+
+/******************************************************************************
+* capture_adopt() - the connection on fd is the one with that id
+******************************************************************************/
+void capture_adopt(int fd, int id)
+{
+   if (captureFD == ERROR_BAD || fd < 0)
+      return;
+   if ((size_t)fd >= ids.size())
+      ids.resize(fd + 1, 0);
+   ids[fd] = id;
+}
+
+/******************************************************************************
+* capture_id() - the id of the connection on fd, 0 if none
+******************************************************************************/
+int capture_id(int fd)
+{
+   return (fd >= 0 && (size_t)fd < ids.size() ? ids[fd] : 0);
+}
+
+/******************************************************************************
+* capture_frame() - records a frame (without its '\0') of the connection
+******************************************************************************/
+void capture_frame(int fd, int type, const char* frame, int length)
+{
+   if (captureFD == ERROR_BAD)
+      return;
+
+   char header[HEADER_SIZE];
+   long long time = now_us();
+   int conn = capture_id(fd);
+   memcpy(header, &time, 8);
+   memcpy(header + 8, &conn, 4);
+   header[12] = type;
+   header[13] = length;
+   buffered.append(header, HEADER_SIZE);
+   buffered.append(frame, length);
+
+   if (buffered.size() >= FLUSH_SIZE)
+      capture_flush();
+}
+
+/******************************************************************************
+* capture_flush() - writes the buffered records out. Called before sleeping,
+*                   and before forking (or the child writes them again). If
+*                   the file can't be written, capturing stops.
+******************************************************************************/
+int capture_flush()
+{
+   if (captureFD == ERROR_BAD || buffered.empty())
+      return ERROR_OK;
+
+   size_t done = 0;
+   while (done < buffered.size())
+   {
+      ssize_t count = write(captureFD, buffered.data() + done,
+                            buffered.size() - done);
+      if (count <= 0)
+      {
+         close(captureFD);
+         captureFD = ERROR_BAD;
+         buffered.clear();
+         return ERROR_BAD;
+      }
+      done += count;
+   }
+   buffered.clear();
+   return ERROR_OK;
+}
+
+/******************************************************************************
+* capture_load() - reads the records of a capture file, in the file's order
+******************************************************************************/
+int capture_load(const char* path, vector<CaptureRecord>& records)
+{
+   int fd = open(path, O_RDONLY);
+   if (fd == ERROR_BAD)
+      return ERROR_BAD;
+
+   string data;
+   char chunk[64 * 1024];
+   ssize_t count;
+   while ((count = read(fd, chunk, sizeof(chunk))) > 0)
+      data.append(chunk, count);
+   close(fd);
+
+   if (count < 0 || data.size() < sizeof(MAGIC) ||
+       memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0)
+      return ERROR_BAD;
+
+   size_t at = sizeof(MAGIC);
+   while (at + HEADER_SIZE <= data.size())
+   {
+      CaptureRecord record;
+      const char* header = data.data() + at;
+      unsigned char length = header[13];
+      if (at + HEADER_SIZE + length > data.size())
+         break; // cut short, e.g. the server was killed mid-write
+
+      memcpy(&record.time, header, 8);
+      memcpy(&record.conn, header + 8, 4);
+      record.type = header[12];
+      record.frame.assign(header + HEADER_SIZE, length);
+      records.push_back(record);
+      at += HEADER_SIZE + length;
+   }
+   return ERROR_OK;
+}
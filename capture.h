@@ -0,0 +1,50 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <string>
+#include <vector>
+
+/******************************************************************************
+* CAPTURE - records the server's traffic for replay (see replay.cpp): every
+*   frame read or written, with the time and the connection it went through.
+*   Every process of the server (the lobby, its games, its workers) appends
+*   to the same file. A connection keeps its id when it moves to another
+*   process. Records are buffered, and written out before the process's
+*   event loop goes to sleep, so the capture costs no system call per frame.
+*
+*   The file: "RPSCAP1" and a '\0', then the records, each one
+*      8 bytes   now_us() of the frame
+*      4 bytes   connection id, from 1, in the order they were accepted
+*      1 byte    type (captureTypes)
+*      1 byte    length of the frame
+*      length    the frame, without its '\0'
+*   in this machine's byte order. Processes flush at different times: the
+*   records are only in time order per connection and per process.
+******************************************************************************/
+enum captureTypes
+{
+   CAPTURE_OPEN,  // the server accepted the connection
+   CAPTURE_IN,    // a frame from the client
+   CAPTURE_OUT,   // a frame to the client
+   CAPTURE_CLOSE  // the client hung up (or the read failed)
+};
+
+struct CaptureRecord
+{
+   long long time; // now_us()
+   int conn;
+   int type;
+   std::string frame;
+};
+
+int capture_start(const char* path);
+void capture_reset(); // in a child that closed its fds: reopen the file
+void capture_open(int fd);           // a new connection gets the next id
+void capture_adopt(int fd, int id);  // a connection handed over by the lobby
+int capture_id(int fd);              // 0 if not captured
+void capture_frame(int fd, int type, const char* frame, int length);
+int capture_flush();                 // ERROR_BAD once writing failed
+
+int capture_load(const char* path, std::vector<CaptureRecord>& records);
+
+#endif
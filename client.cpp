@@ -15,30 +15,41 @@
 // #include <sys/socket.h>
 // #include <sys/types.h>
 
+#include <cerrno> // errno
+#include <csignal> // signal
 #include <cstring> // memcpy, bcopy, strcmp
+#include <fcntl.h> // fcntl, O_NONBLOCK
 #include <iostream> // cout
 #include <netdb.h> // gethostbyname
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <poll.h> // poll
+#include <sys/un.h> // sockaddr_un
 #include <sstream> // stringstream
-#include <unistd.h> // gethostname, close
+#include <unistd.h> // gethostname, close, read
 
 #include "constants.h"
 #include "helpers.h"
 #include "client.h"
+#include "transport.h"
 
 using namespace std;
 
 /******************************************************************************
 * MAIN
-* argv: host_name, port_number
+* argv: host_name, port_number ~ or ~ socket_path, [shm]
 ******************************************************************************/
 int main(int argc, char** argv)
 {
    char host[MAXLEN];
    int port;
+   bool useShm;
 
-   parseClientArgs(argc, argv, host, port);
+   parseClientArgs(argc, argv, host, port, useShm);
 
-   Client client(host, port);
+   // a server that went away is handled on the write, not by a signal
+   signal(SIGPIPE, SIG_IGN);
+
+   Client client(host, port, useShm);
    client.run();
 
    return 0;
@@ -46,10 +57,22 @@ int main(int argc, char** argv)
 
 /******************************************************************************
 * Client Constructor - attempts to connect to hostname on the given port number
+*                      (or to the server's Unix domain socket). useShm asks
+*                      the server for the shared memory transport.
 ******************************************************************************/
-Client::Client(char* hostname, int port)
+Client::Client(char* hostname, int port, bool useShm)
+   : useShm(useShm), inLobby(false), awaitingShm(false), running(true),
+     isFirstRound(true), prompt(NO_PROMPT), followUp(-1), listed(0)
 {
-   socketFD = connectToServer(hostname, port);
+   if (isSocketPath(hostname))
+      socketFD = connectToLocalServer(hostname);
+   else
+      socketFD = connectToServer(hostname, port);
+
+   // the event loop never waits on the server: it reads whole frames as
+   // they arrive, and its writes are queued until the socket takes them
+   fcntl(socketFD, F_SETFL, fcntl(socketFD, F_GETFL) | O_NONBLOCK);
+   transport_queue_writes(socketFD);
    playerName = new char[MAXLEN];
    opponentName = new char[MAXLEN];
    results = new int[3]; // wins/losses/draws
@@ -65,62 +88,178 @@ Client::~Client()
    delete [] opponentName;
    delete [] results;
 
-   // make sure to close the socket
+   // make sure to close the socket, with what is still queued sent (it
+   // fits in the kernel's buffer: the client only sends a few frames)
+   transport_flush(socketFD);
+   transport_close(socketFD);
    shutdown(socketFD, SHUT_RDWR);
    close(socketFD);
 }
 
 /******************************************************************************
-* run() - loop forever, getting commands from the server, and acting according
-*         to those commands.
+* run() - the event loop: waits on the server and on the user at once, until
+*         the game is over or the server is gone. Commands from the server
+*         are acted upon the moment they arrive. A line typed by the user
+*         answers the current prompt; typed ahead of it, it waits for it.
 ******************************************************************************/
 void Client::run()
 {
-   int opCode = -1;
-   char buffer[MAXLEN];
-   bool gameIsSet = false; // true after name is prompted and opponent given
-   bool isFirstRound = true;
-   bool running = true;
-
    while(running)
    {
-      if (isFirstRound && gameIsSet)
-         updateDisplay();
+      // send what the last events queued before going to sleep
+      transport_flush(socketFD);
+
+      // stdin is only watched while something is asked, so a line typed
+      // ahead stays where it is
+      int timeout = -1;
+      struct pollfd fds[2];
+      fds[0].fd = socketFD;
+      fds[0].events = transport_events(socketFD, timeout);
+      fds[0].revents = 0;
+      fds[1].fd = (prompt == NO_PROMPT ? -1 : STDIN_FILENO);
+      fds[1].events = POLLIN;
+      fds[1].revents = 0;
+
+      if (poll(fds, 2, timeout) == ERROR_BAD)
+      {
+         if (errno == EINTR)
+            continue;
+         exitErr("Failed to wait on the Server and the keyboard");
+      }
+
+      if (fds[0].revents & (POLLOUT | POLLHUP | POLLERR))
+         transport_flush(socketFD);
+
+      // a readable socket, or shared memory that already has data. The
+      // answer to the shared memory request is read apart: its fd rides
+      // along with it
+      if (awaitingShm)
+      {
+         if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+            onShmAnswer();
+      }
+      else if (transport_failed(socketFD) ||
+               (fds[0].revents & (POLLIN | POLLHUP | POLLERR) ?
+                transport_readable(socketFD) : transport_pending(socketFD)))
+         onServerReadable();
+
+      if (running && fds[1].revents)
+         onInputReadable();
+
+      handleTypedLines();
+   }
+}
 
-      // read the command from the server
-      read_data(socketFD, buffer);
-      opCode = parseCommand(buffer);
-      switch(opCode)
+/******************************************************************************
+* onServerReadable() - handles every whole frame that arrived from the
+*                      server: a command, or what completes the last one
+*                      (the opponent's name, the result message, the names
+*                      of a list). A partial frame waits for the rest.
+*                      Losing the server is as good as a PDC.
+******************************************************************************/
+void Client::onServerReadable()
+{
+   char buffer[MAXLEN];
+   int length;
+   while (running && !awaitingShm)
+   {
+      length = (transport_failed(socketFD) ? ERROR_BAD :
+                read_frame(socketFD, buffer));
+      if (length == 0)
+         break;
+      if (length == ERROR_BAD)
       {
-         case NAME:
-            handlePlayerName();
-            break;
-         case OPNT:
-            handleOpponentName();
-            gameIsSet = true;
-            break;
-         case ROUND:
-            handleRoundOption(isFirstRound);
-            break;
-         case RWIN:
-         case RLOSS:
-         case RDRAW:
-            handleRoundResult(opCode);
-            break;
-         case PDC:
-            running = false;
-            cout << "Server closed by Player, or server error.\n";
-            cout << "\nYour final results: ( W / L / D )" << endl
-                 << "                      " << results[WINS] << " / "
-                 << results[LOSSES] << " / "
-                 << results[DRAWS] << endl;
-            break;
-         default:
-            cout << "Failed to parse the command from the Server!\n";
+         followUp = -1;
+         strcpy(buffer, DC);
       }
+
+      if (followUp != -1)
+         handleFollowUp(buffer);
+      else
+         handleCommand(parseCommand(buffer));
    }
 }
 
+/******************************************************************************
+* onShmAnswer() - the server's answer to the shared memory request came:
+*                 attach to the memory it handed over, if it did
+******************************************************************************/
+void Client::onShmAnswer()
+{
+   awaitingShm = false;
+   if (shm_accept(socketFD) == ERROR_OK)
+      cout << "Using shared memory to talk to the Server\n";
+   else
+      cout << "Shared memory refused, staying on the socket\n";
+}
+
+/******************************************************************************
+* onInputReadable() - takes what the user typed so far, without waiting for
+*                     more. Once stdin is closed there is nobody left to
+*                     play: hang up.
+******************************************************************************/
+void Client::onInputReadable()
+{
+   char buffer[MAXLEN];
+   ssize_t size = read(STDIN_FILENO, buffer, sizeof(buffer));
+   if (size > 0)
+      typed.append(buffer, size);
+   else if (size == 0 || (errno != EINTR && errno != EAGAIN))
+   {
+      cout << "\nBye!\n";
+      running = false;
+   }
+}
+
+/******************************************************************************
+* handleTypedLines() - answers the current prompt with the lines typed, for
+*                      as long as something is asked
+******************************************************************************/
+void Client::handleTypedLines()
+{
+   size_t end;
+   while (running && prompt != NO_PROMPT &&
+          (end = typed.find('\n')) != string::npos)
+   {
+      string line = typed.substr(0, end);
+      typed.erase(0, end + 1);
+      if (!line.empty() && line[line.size() - 1] == '\r')
+         line.erase(line.size() - 1);
+      if (line.size() >= (size_t)MAXLEN - 1)
+         line.resize(MAXLEN - 2); // it has to fit in a frame
+
+      int answered = prompt;
+      prompt = NO_PROMPT; // the handler asks again if it needs more
+      if (answered == NAME_PROMPT)
+         handlePlayerName(line.c_str());
+      else if (answered == LOBBY_PROMPT)
+         handleLobby(line.c_str());
+      else if (answered == WAIT_PROMPT)
+         handleWaiting(line.c_str());
+      else
+         handleRoundOption(line.c_str());
+   }
+}
+
+/******************************************************************************
+* ask() - prompts the user. The answer is handled by handleTypedLines().
+******************************************************************************/
+void Client::ask(int what)
+{
+   if (what == NAME_PROMPT)
+      cout << "What is your name?\n>";
+   else if (what == LOBBY_PROMPT)
+      cout << "Press Enter to play the next player that shows up, '?' to "
+           << "list the players waiting,\nor type the name of a player to "
+           << "challenge:\n>";
+   else if (what == WAIT_PROMPT)
+      cout << "Waiting for an opponent... ('q' to quit)\n";
+   else if (what == MOVE_PROMPT)
+      cout << "Enter a single character:\n>";
+   cout << flush;
+   prompt = what;
+}
+
 /******************************************************************************
 * connectToServer() - attempts to establish a connection between the client
 *                     and the server. If successful, saves the Server's
@@ -156,6 +295,44 @@ int Client::connectToServer(char* hostname, int port)
       exitErr("Failed to connect to the Server");
    }
 
+   // the moves and PINGs are tiny, send them right away
+   int on = 1;
+   setsockopt(socketFD, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+   cout << "Successfully connected to the Server\n";
+   return socketFD;
+}
+
+/******************************************************************************
+* connectToLocalServer() - same as connectToServer(), but through the Unix
+*                          domain socket bound at the given path
+******************************************************************************/
+int Client::connectToLocalServer(char* path)
+{
+   int socketFD;
+   struct sockaddr_un socketAddress;
+
+   if (strlen(path) >= sizeof(socketAddress.sun_path))
+   {
+      exitErr("socket path is too long");
+   }
+
+   socketFD = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (socketFD == ERROR_BAD)
+   {
+      exitErr("error on creating socket");
+   }
+
+   memset(&socketAddress, 0, sizeof(socketAddress));
+   socketAddress.sun_family = AF_UNIX;
+   strcpy(socketAddress.sun_path, path);
+
+   if (connect(socketFD, (struct sockaddr *)&socketAddress,
+               sizeof(socketAddress)) != ERROR_OK)
+   {
+      exitErr("Failed to connect to the Server");
+   }
+
    cout << "Successfully connected to the Server\n";
    return socketFD;
 }
@@ -180,79 +357,262 @@ int Client::parseCommand(char* cmd)
       opCode = RDRAW;
    else if(strcmp(cmd, "PDC") == 0)
       opCode = PDC;
+   else if(strcmp(cmd, "BUSY") == 0)
+      opCode = BUSY;
+   else if(strcmp(cmd, "PING") == 0)
+      opCode = PINGED;
+   else if(strcmp(cmd, "PONG") == 0)
+      opCode = PONGED;
+   else if(strcmp(cmd, "LIST") == 0)
+      opCode = LIST;
+   else if(strcmp(cmd, "NOPLR") == 0)
+      opCode = NOPLR;
+   else if(strcmp(cmd, "INGAME") == 0)
+      opCode = INGAME;
+   else if(strcmp(cmd, "NAMED") == 0)
+      opCode = NAMED;
    return opCode;
 }
 
 /******************************************************************************
-* handlePlayerName() - prompts the player for a name and then sends it to the
-*                      server
+* handleCommand() - acts upon a command from the server
 ******************************************************************************/
-void Client::handlePlayerName()
+void Client::handleCommand(int opCode)
 {
-   // prompt user for his name, send it to the server
-   cout << "What is your name?\n>";
-   cin.getline(playerName, MAXLEN);
+   switch(opCode)
+   {
+      case NAME:
+         if (useShm)
+         {
+            // only ask once. Either way the server asks for the name again
+            useShm = false;
+            handleShmRequest();
+         }
+         else if (!inLobby)
+         {
+            // don't get paired with anybody before the user picks
+            inLobby = true;
+            write_data(socketFD, LOBBY);
+         }
+         else
+            ask(NAME_PROMPT);
+         break;
+      case LIST:
+         listed = 0;
+         followUp = LIST;
+         break;
+      case NAMED:
+         followUp = opCode; // the name the server gave comes next
+         break;
+      case NOPLR:
+         cout << "Nobody by that name is waiting.\n";
+         ask(LOBBY_PROMPT);
+         break;
+      case INGAME:
+         cout << "That player is in a game right now.\n";
+         ask(LOBBY_PROMPT);
+         break;
+      case OPNT:
+         // a challenge may come in while the user is still picking: the
+         // game is on now, the next line typed is a move
+         prompt = NO_PROMPT;
+         followUp = opCode; // the name comes next
+         break;
+      case RWIN:
+      case RLOSS:
+      case RDRAW:
+         followUp = opCode; // the message comes next
+         break;
+      case ROUND:
+         if (isFirstRound)
+            displayOptions();
+         isFirstRound = false;
+         ask(MOVE_PROMPT);
+         break;
+      case PDC:
+         running = false;
+         cout << "\nServer closed by Player, or server error.\n";
+         displayResults();
+         break;
+      case BUSY:
+         running = false;
+         cout << "The Server is too busy right now, try again later.\n";
+         break;
+      case PINGED:
+         write_data(socketFD, PONG);
+         break;
+      case PONGED:
+         rtt.ponged(now_us());
+         break;
+      default:
+         cout << "Failed to parse the command from the Server!\n";
+   }
+}
 
-   write_data(socketFD, playerName);
+/******************************************************************************
+* handleFollowUp() - the frame that completes the last command
+******************************************************************************/
+void Client::handleFollowUp(char* buffer)
+{
+   int opCode = followUp;
+   followUp = -1;
+
+   switch(opCode)
+   {
+      case OPNT:
+         strcpy(opponentName, buffer);
+         cout << "Your opponent for this game is '" << opponentName << "'\n";
+         updateDisplay();
+         break;
+      case RWIN:
+      case RLOSS:
+      case RDRAW:
+         handleRoundResult(opCode, buffer);
+         break;
+      case LIST:
+         handleIdleName(buffer);
+         break;
+      case NAMED:
+         if (strcmp(buffer, playerName) != 0)
+            cout << "That name is taken, you are '" << buffer << "'\n";
+         strcpy(playerName, buffer);
+         break;
+   }
 }
 
 /******************************************************************************
-* handleOpponentName() - reads from the server the opponent's name and then
-*                        displays it to the user
+* handlePlayerName() - sends the name the user typed to the server, then
+*                      asks who to play
 ******************************************************************************/
-void Client::handleOpponentName()
+void Client::handlePlayerName(const char* name)
 {
-   read_data(socketFD, opponentName);
-   cout << "Your opponent for this game is '" << opponentName << "'\n";
+   strcpy(playerName, name);
+   write_data(socketFD, playerName);
+   ask(LOBBY_PROMPT);
 }
 
 /******************************************************************************
-* handleRoundOption() - allows the user to input his/her choice. Then send that
-*                       choice to the server if it's a R/P/S/Q.
+* handleLobby() - who the user wants to play: whoever shows up next (empty
+*                 line), or a player challenged by name. '?' lists who is
+*                 waiting.
 ******************************************************************************/
-void Client::handleRoundOption(bool& isFirstRound)
+void Client::handleLobby(const char* choice)
 {
-   char option = 'z';
-   if (isFirstRound)
-      displayOptions();
+   if (!choice[0])
+   {
+      write_data(socketFD, PLAY_ANY);
+      ask(WAIT_PROMPT); // until the game starts
+   }
+   else if (strcmp(choice, "?") == 0)
+      write_data(socketFD, LIST_IDLE);
+   else
+   {
+      write_data(socketFD, CHALLENGE);
+      write_data(socketFD, choice);
+   }
+}
 
-   // PROMPT
-   while(!isValidOption(option))
+/******************************************************************************
+* handleWaiting() - a line typed while waiting for an opponent: 'q' hangs up,
+*                   anything else is too early
+******************************************************************************/
+void Client::handleWaiting(const char* line)
+{
+   while (isspace(*line))
+      line++;
+   if (tolower(*line) == QUIT)
    {
-      cout << "Enter a single character:\n>";
-      cin >> option;
-      option = tolower(option);
+      cout << "\nBye!\n";
+      running = false;
+      return;
+   }
 
-      if (!isValidOption(option))
-      {
-         cout << "\nInvalid entry!\n";
-         displayOptions();
-      }
+   cout << "The game has not started yet.\n";
+   ask(WAIT_PROMPT);
+}
+
+/******************************************************************************
+* handleIdleName() - one name of the list of the players waiting. The empty
+*                    one ends the list: ask who to play again.
+******************************************************************************/
+void Client::handleIdleName(const char* name)
+{
+   if (name[0])
+   {
+      cout << (listed++ ? ", " : "Waiting: ") << name;
+      followUp = LIST;
+      return;
    }
 
-   isFirstRound = false;
+   cout << (listed ? "\n" : "Nobody else is waiting.\n");
+   ask(LOBBY_PROMPT);
+}
 
-   if (option == 't')
+/******************************************************************************
+* handleShmRequest() - answers the name prompt with a request for the shared
+*                      memory transport. The answer is read by onShmAnswer()
+*                      when it comes.
+******************************************************************************/
+void Client::handleShmRequest()
+{
+   write_data(socketFD, SHM);
+   transport_flush(socketFD); // on the socket, before it may switch
+   awaitingShm = true;
+}
+
+/******************************************************************************
+* handleRoundOption() - the user's choice for this round, the first character
+*                       of the line. Sends it to the server if it's a R/P/S/Q,
+*                       otherwise asks again.
+******************************************************************************/
+void Client::handleRoundOption(const char* line)
+{
+   while (isspace(*line))
+      line++;
+   if (!*line)
+   {
+      ask(MOVE_PROMPT);
+      return;
+   }
+
+   char option = tolower(*line);
+   if (!isValidOption(option))
+   {
+      cout << "\nInvalid entry!\n";
+      displayOptions();
+      ask(MOVE_PROMPT);
+   }
+   else if (option == 't')
    {
       updateDisplay();
-      handleRoundOption(isFirstRound); // this recursion should be safe :)
+      ask(MOVE_PROMPT);
    }
    else if (option == '?')
    {
       displayOptions();
-      handleRoundOption(isFirstRound);
+      ask(MOVE_PROMPT);
    }
    else
-      write_data(socketFD, &option);    // Send the Option back to the server
+   {
+      // probe the round trip first: the server answers it before the round
+      // result, while this client waits for it anyway
+      long long now = now_us();
+      if (rtt.isDue(now))
+      {
+         rtt.pinged(now);
+         write_data(socketFD, PING);
+      }
+      char move[2] = { option, '\0' };
+      write_data(socketFD, move);       // Send the Option back to the server
+   }
 }
 
 /******************************************************************************
-* handleRoundResult() - updates the score, reads from the server the result
-*                       message and then displays it to the user
+* handleRoundResult() - updates the score, then displays the server's message
+*                       on the result
 ******************************************************************************/
-void Client::handleRoundResult(int resultType)
+void Client::handleRoundResult(int resultType, const char* message)
 {
-   char buffer[MAXLEN];
    // set the resultType to contain the appropriate index
    if      (resultType == RWIN)  resultType = WINS;
    else if (resultType == RLOSS) resultType = LOSSES;
@@ -261,9 +621,7 @@ void Client::handleRoundResult(int resultType)
    // update the score
    results[resultType]++;
 
-   // get message on the result from the server and display it
-   read_data(socketFD, buffer);
-   cout << "Result: " << buffer << endl;
+   cout << "Result: " << message << endl;
 }
 
 /******************************************************************************
@@ -278,6 +636,9 @@ void Client::updateDisplay()
         << "                " << results[WINS] << " / "
         << results[LOSSES] << " / "
         << results[DRAWS] << endl;
+   if (rtt.isKnown())
+      cout << "Round trip to the Server: " << rtt.getSmoothed() / 1000.0
+           << " ms (+/- " << rtt.getVariation() / 1000.0 << " ms)" << endl;
    cout << endl;
 }
 
@@ -303,3 +664,14 @@ void Client::displayOptions()
         << " ? - Display these options\n"
         << " q - Quit\n";
 }
+
+/******************************************************************************
+* displayResults() - the final score
+******************************************************************************/
+void Client::displayResults()
+{
+   cout << "\nYour final results: ( W / L / D )" << endl
+        << "                      " << results[WINS] << " / "
+        << results[LOSSES] << " / "
+        << results[DRAWS] << endl;
+}
@@ -1,13 +1,30 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#include <string>
+#include "rtt.h"
+
 /******************************************************************************
-* Client Class
+* what the next line the user types answers
+******************************************************************************/
+enum prompts
+{
+   NO_PROMPT,    // nothing asked: the typed lines wait for the next prompt
+   NAME_PROMPT,  // the player's name
+   LOBBY_PROMPT, // who to play
+   WAIT_PROMPT,  // waiting for an opponent: only 'q' (or EOF) counts
+   MOVE_PROMPT   // the move for this round
+};
+
+/******************************************************************************
+* Client Class - one event loop over the server's socket and stdin: whatever
+*   the server sends is handled as soon as it arrives, even while the user
+*   is still typing.
 ******************************************************************************/
 class Client
 {
    public:
-      Client(char* hostname, int port);
+      Client(char* hostname, int port, bool useShm = false);
       ~Client();
       void run();
 
@@ -16,19 +33,43 @@ class Client
       char* playerName;
       char* opponentName;
       int* results;
+      bool useShm; // ask the server for the shared memory transport
+      bool inLobby; // told the server this client picks its opponent
+      bool awaitingShm; // asked for the shared memory, the answer is next
+      RttProbe rtt; // round trip time to the server
+      bool running;
+      bool isFirstRound;
+      int prompt;    // what the next line typed answers (prompts)
+      int followUp;  // the command the next frame completes, -1 if none
+      int listed;    // names of the LIST being received
+      std::string typed; // read from stdin, not used yet
 
       // socket functionality
       int connectToServer(char* hostname, int port);
+      int connectToLocalServer(char* path);
+
+      // the event loop
+      void onServerReadable();
+      void onShmAnswer();
+      void onInputReadable();
+      void handleTypedLines();
+      void ask(int what);
 
       // client-server interaction / game functionality
       int parseCommand(char* cmd);
-      void handlePlayerName();
-      void handleOpponentName();
-      void handleRoundOption(bool& isFirstRound);
-      void handleRoundResult(int resultType);
+      void handleCommand(int opCode);
+      void handleFollowUp(char* buffer);
+      void handlePlayerName(const char* name);
+      void handleLobby(const char* choice);
+      void handleWaiting(const char* line);
+      void handleIdleName(const char* name);
+      void handleShmRequest();
+      void handleRoundOption(const char* line);
+      void handleRoundResult(int resultType, const char* message);
       void updateDisplay();
       bool isValidOption(char option);
       void displayOptions();
+      void displayResults();
 };
 
 #endif
@@ -9,6 +9,16 @@ const int DEFAULT_PORT = 6789;
 const int ERROR_BAD = -1;
 const int ERROR_OK = 0;
 const int MAXLEN = 256; // size of the buffer
+const int DEFAULT_BACKLOG = 1024; // pending connections per welcome socket
+const int DEFAULT_MAX_CONNECTIONS = 4096; // held by the server and its games
+const int DEFAULT_IP_RATE = 10;     // new connections per second from an IP
+const int DEFAULT_MAX_WAITING = 1024; // players waiting to be paired
+const int STATS_INTERVAL = 60;      // seconds between two stats logs
+const int DEFAULT_BOT_WAIT = 30; // seconds a lone player waits for the bot
+const int PING_INTERVAL = 2;     // seconds between two RTT probes
+const int GREETING_TIMEOUT = 10; // seconds a client has to give its name
+const int LIST_MAX = 20;         // names sent back for one LIST
+const char BOT_NAME[] = "RPS-Bot"; // name of the server side opponent
 
 // gets rid of "deprecated conversion from string constant ... compiler warning
 #pragma GCC diagnostic ignored "-Wwrite-strings"
@@ -21,12 +31,25 @@ const int MAXLEN = 256; // size of the buffer
 
 // commands
 #define GET_NAME "NAME" // prompt for the name of the player
+#define NAME_ACK "NAMED" // the name the player got is next (see protocol)
 #define SET_OPPONENT "OPNT" // let player 'x' know who player 'y' is
 #define TURN "ROUND" // start a new round ~ get input from players
 #define WIN "RWIN"   // player 'x' won this round
 #define LOSS "RLOSS" // player 'y' lost this round
 #define DRAW "RDRAW" // this round was a tie
 #define DC "PDC"     // one of the players disconnected or quit
+#define SHM "SHM"    // client asks for / server hands over a shared memory
+#define NO_SHM "NOSHM" // server can't set up shared memory for this client
+#define SERVER_BUSY "BUSY" // server is too busy to take the client, bye
+#define PING "PING"  // either side probes the round trip time...
+#define PONG "PONG"  // ...and the other side answers right away
+#define LOBBY "LOBBY" // client will say who it wants to play (see protocol)
+#define PLAY_ANY "ANY" // client wants the next player that shows up
+#define WAIT_CHALLENGE "WAIT" // client only wants to be challenged
+#define LIST_IDLE "LIST" // client asks for / server sends the idle players
+#define CHALLENGE "CHAL" // client challenges the player named next
+#define NO_PLAYER "NOPLR" // nobody by that name is waiting
+#define IN_GAME "INGAME"  // the challenged player is in a game
 
 // integer representation of the commands above
 enum codes {
@@ -36,13 +59,21 @@ enum codes {
    RWIN,
    RLOSS,
    RDRAW,
-   PDC
+   PDC,
+   BUSY,
+   PINGED,
+   PONGED,
+   LIST,
+   NOPLR,
+   INGAME,
+   NAMED
 };
 
 // used to access the array of integers for each player
 enum results { WINS, LOSSES, DRAWS };
 
-// the integer representing who won that round
-enum roundResults { P1 = -1, TIE = 0, P2 = 1 };
+// the integer representing who won that round (or that match, which can
+// also end before any round was played)
+enum roundResults { P1 = -1, TIE = 0, P2 = 1, NO_CONTEST = 2 };
 
 #endif
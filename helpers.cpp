@@ -1,9 +1,11 @@
 #include <cstdlib>  // exit
-#include <cstring>  // strlen
+#include <cstring>  // strlen, strcmp, memcpy
+#include <ctime>    // clock_gettime
 #include <iostream> // cout
-#include <unistd.h> // read, write
 #include "helpers.h"
-#include "constants.h" // ERROR_BAD
+#include "capture.h"   // capture_frame
+#include "constants.h" // ERROR_BAD, MAXLEN
+#include "transport.h" // transport_read, transport_write, isSocketPath
 
 /******************************************************************************
 * HELPERS / UTILS
@@ -15,7 +17,25 @@ void exitErr(std::string msg)
    exit(ERROR_BAD);
 }
 
-// read_data - reads data from the socket stream
+// now_ms - milliseconds from a monotonic clock, for measuring wait times
+long long now_ms()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// now_us - microseconds from the same clock, for measuring round trips
+long long now_us()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// read_data - reads data from the socket stream. Returns ERROR_BAD if the
+//   connection failed or was closed by the other side. The frame goes in the
+//   capture, if the server is capturing
 int read_data (int fd , char* buffer )
 {
    // temp is a char that represents the length of the message being sent.
@@ -23,56 +43,89 @@ int read_data (int fd , char* buffer )
    char temp;
    int i = 0;
    int length = 0;
+   int count = 0;
 
    // 1st character = Get the Length of the Message
-   if ( read ( fd , &temp , 1 ) < 0 )
+   if ( transport_read ( fd , &temp , 1 ) <= 0 )
    {
-      exit (-3) ;
+      capture_frame ( fd , CAPTURE_CLOSE , "" , 0 );
+      return ERROR_BAD;
    }
-   length = temp ;
+   length = (unsigned char) temp ;
 
    // read the actual message. Reads $length chars
    while ( i < length )
    {
-      if ( i < ( i+= read (fd , & buffer [i], length - i)))
+      count = transport_read (fd , & buffer [i], length - i);
+      if ( count <= 0 )
       {
-         exit (-3);
+         capture_frame ( fd , CAPTURE_CLOSE , "" , 0 );
+         return ERROR_BAD;
       }
+      i += count;
    }
+   capture_frame ( fd , CAPTURE_IN , buffer , strnlen ( buffer , i ) );
    return i; /* Return size of char* */
 }
 
-// write_data - writes data to the socket stream
+// read_frame - the event loops' read_data: never blocks. Returns the length
+//   of the next frame that arrived whole, 0 if none did yet (a partial one
+//   waits for the rest), or ERROR_BAD once the other side is gone. The frame
+//   goes in the capture, if the server is capturing
+int read_frame ( int fd , char* buffer )
+{
+   int length = transport_read_frame ( fd , buffer );
+   if ( length == ERROR_BAD )
+      capture_frame ( fd , CAPTURE_CLOSE , "" , 0 );
+   else if ( length > 0 )
+      capture_frame ( fd , CAPTURE_IN , buffer , strlen ( buffer ) );
+   return length;
+}
+
+// write_data - writes data to the socket stream, as a single write so a
+//   queued connection never holds half a frame. Returns ERROR_BAD if the
+//   connection failed or the other side is gone. The frame goes in the
+//   capture, if the server is capturing
 int write_data ( int fd , const char* message )
 {
-   char temp;
+   char frame[MAXLEN + 1];
    int length = 0;
 
-   // get the length of the message and store it into a char
+   // get the length of the message and store it into the 1st char
    length = strlen ( message ) + 1; // +1 to account for the '\0'
-   temp = length ;
-
-   // send a 1 byte (1 char) containing the length of the message
-   if( write (fd , &temp , 1) < 0 )
+   if ( length >= MAXLEN ) // the length must fit in the 1st char
    {
-      exit (-2) ;
+      return ERROR_BAD;
    }
+   frame[0] = length ;
+   memcpy ( frame + 1 , message , length );
 
-   // now send the actual message
-   if( write (fd , message , length ) < 0 )
+   // send the length byte and the actual message together
+   if( transport_write (fd , frame , length + 1 ) < 0 )
    {
-      exit (-2) ;
+      return ERROR_BAD;
    }
+   capture_frame ( fd , CAPTURE_OUT , message , length - 1 );
 
    return length; // returns the length of the message that was sent
 }
 
 // reads the arguments from the client and assigns the host and the port
-// to the appropriate parameters
-void parseClientArgs(int argc, char** argv, char* host, int& port)
+// to the appropriate parameters. A host with a '/' is the path of the
+// server's Unix domain socket; that takes no port, but can ask for "shm"
+void parseClientArgs(int argc, char** argv, char* host, int& port,
+                     bool& useShm)
 {
+   useShm = false;
+
    // argv[1] should be hostname, argv[2] should be port
-   if (argc > 2)
+   if (argc > 1 && isSocketPath(argv[1]))
+   {
+      strcpy(host, argv[1]);
+      port = 0;
+      useShm = (argc > 2 && strcmp(argv[2], "shm") == 0);
+   }
+   else if (argc > 2)
    {
       strcpy(host, argv[1]);
       port = atoi(argv[2]);
@@ -81,7 +134,8 @@ void parseClientArgs(int argc, char** argv, char* host, int& port)
    }
    else
    {
-      std::cout << "Usage: " << argv[0] << " HOSTNAME PORT\n";
+      std::cout << "Usage: " << argv[0] << " HOSTNAME PORT\n"
+                << "       " << argv[0] << " SOCKET_PATH [shm]\n";
       exit(ERROR_BAD);
    }
 }
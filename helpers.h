@@ -1,12 +1,18 @@
 #ifndef HELPERS_H
 #define HELPERS_H
 
+#include <string>
+
 /******************************************************************************
 * HELPERS / UTILS
 ******************************************************************************/
 int write_data(int fd, const char* msg);
 int read_data(int fd, char* msg);
+int read_frame(int fd, char* msg); // never blocks, 0 if no whole frame yet
 void exitErr(std::string msg);
-void parseClientArgs(int argc, char** argv, char* host, int& port);
+long long now_ms();
+long long now_us();
+void parseClientArgs(int argc, char** argv, char* host, int& port,
+                     bool& useShm);
 
 #endif
@@ -0,0 +1,305 @@
+#include <cerrno>   // errno
+#include <cstring>  // memset, strchr, strrchr
+#include <fcntl.h>  // open
+#include <netdb.h>  // getaddrinfo
+#include <netinet/in.h> // sockaddr_in, sockaddr_in6, IPV6_V6ONLY
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <sys/socket.h> // socket, bind, listen, accept4
+#include <sys/un.h> // sockaddr_un
+#include <unistd.h> // close, unlink
+#include "listener.h"
+#include "helpers.h" // exitErr
+#include "logger.h"
+
+using namespace std;
+
+const long long FD_WARNING_INTERVAL = 1000; // ms between two warnings
+
+/******************************************************************************
+* Listener constructor
+******************************************************************************/
+Listener::Listener(int backlog, bool reusePort)
+   : backlog(backlog), reusePort(reusePort), dropped(0), warned(0)
+{
+   spareFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+/******************************************************************************
+* Listener destructor - closes the welcome sockets, removes the socket files
+******************************************************************************/
+Listener::~Listener()
+{
+   for (vector<int>::iterator it = fds.begin(); it != fds.end(); ++it)
+      close(*it);
+   if (spareFD != ERROR_BAD)
+      close(spareFD);
+   for (vector<string>::iterator it = unixPaths.begin();
+        it != unixPaths.end(); ++it)
+      unlink(it->c_str());
+}
+
+/******************************************************************************
+* add() - parses the address (see listener.h) and starts listening on it
+******************************************************************************/
+void Listener::add(const char* address)
+{
+   string spec(address);
+
+   if (spec.compare(0, 5, "unix:") == 0)
+   {
+      addUnix(address + 5);
+      return;
+   }
+
+   string host;
+   string port;
+   if (spec[0] == '[')
+   {
+      // [IPV6]:PORT
+      size_t end = spec.find("]:");
+      if (end == string::npos)
+         exitErr("invalid listen address: " + spec);
+      host = spec.substr(1, end - 1);
+      port = spec.substr(end + 2);
+   }
+   else if (spec.find(':') != string::npos)
+   {
+      // HOST:PORT or *:PORT
+      size_t colon = spec.rfind(':');
+      host = spec.substr(0, colon);
+      port = spec.substr(colon + 1);
+   }
+   else
+      port = spec; // just the PORT
+
+   if (host == "*")
+      host.clear();
+
+   addInet(host.empty() ? NULL : host.c_str(), port.c_str());
+}
+
+/******************************************************************************
+* addUnix() - listens on a Unix domain socket bound at the given path
+******************************************************************************/
+void Listener::addUnix(const char* path)
+{
+   struct sockaddr_un socketAddress;
+
+   if (strlen(path) >= sizeof(socketAddress.sun_path))
+      exitErr("socket path is too long");
+
+   int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if (fd == ERROR_BAD)
+   {
+      exitErr("error on creating the unix socket");
+   }
+
+   memset(&socketAddress, 0, sizeof(socketAddress));
+   socketAddress.sun_family = AF_UNIX;
+   strcpy(socketAddress.sun_path, path);
+   unlink(path); // left over from a previous run?
+
+   if (bind(fd, (struct sockaddr *)&socketAddress,
+            sizeof(socketAddress)) != ERROR_OK)
+   {
+      exitErr("error on bind of the unix socket!");
+   }
+
+   unixPaths.push_back(path);
+   startListening(fd, path);
+}
+
+/******************************************************************************
+* addInet() - listens on every address the host resolves to. A NULL host is
+*             the wildcard: IPv6 with IPv4 mapped in (dual stack), or just
+*             IPv4 if no IPv6 socket could be bound (no IPv6 on this machine,
+*             or it is disabled).
+******************************************************************************/
+void Listener::addInet(const char* host, const char* port)
+{
+   int bound;
+   if (host)
+      bound = bindAll(host, port, AF_UNSPEC);
+   else
+   {
+      bound = bindAll(host, port, AF_INET6);
+      if (!bound)
+      {
+         LOG_WARN("no IPv6 on *:{}, falling back to IPv4", port);
+         bound = bindAll(host, port, AF_INET);
+      }
+   }
+
+   if (!bound)
+      exitErr("error on bind!");
+}
+
+/******************************************************************************
+* bindAll() - binds and listens on every address of the family that the host
+*             resolves to. Returns how many it listens on. An unresolvable
+*             host exits, the wildcard just binds nothing.
+******************************************************************************/
+int Listener::bindAll(const char* host, const char* port, int family)
+{
+   struct addrinfo hints;
+   struct addrinfo* addresses = NULL;
+
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = family;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+   int error = getaddrinfo(host, port, &hints, &addresses);
+   if (error != ERROR_OK)
+   {
+      if (host)
+         exitErr(string("can't resolve listen address: ") +
+                 gai_strerror(error));
+      return 0;
+   }
+
+   int bound = 0;
+   for (struct addrinfo* it = addresses; it; it = it->ai_next)
+   {
+      int fd = socket(it->ai_family,
+                      it->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd == ERROR_BAD)
+      {
+         LOG_WARN("error on socket: {}", strerror(errno));
+         continue;
+      }
+
+      int on = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      if (reusePort)
+         setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+      if (it->ai_family == AF_INET6)
+      {
+         // the wildcard takes IPv4 as well, a specific address only itself
+         int v6only = (host ? 1 : 0);
+         setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+      }
+
+      if (bind(fd, it->ai_addr, it->ai_addrlen) != ERROR_OK)
+      {
+         LOG_WARN("error on bind: {}", strerror(errno));
+         close(fd);
+         continue;
+      }
+
+      startListening(fd, string(host ? host : "*") + ":" + port);
+      bound++;
+   }
+   freeaddrinfo(addresses);
+   return bound;
+}
+
+/******************************************************************************
+* startListening() - listen() on the bound socket and keep it
+******************************************************************************/
+void Listener::startListening(int fd, const string& address)
+{
+   if (listen(fd, backlog) != ERROR_OK)
+   {
+      exitErr("error on listen!");
+   }
+
+   fds.push_back(fd);
+   LOG_INFO("Socket opened successfully on {}", address);
+}
+
+/******************************************************************************
+* acceptAll() - accepts every connection pending on the welcome socket, until
+*               it would block. The accepted sockets are non-blocking (the
+*               server never waits on a client), and send the frames right
+*               away (the lobby's replies take a few frames: Nagle would
+*               hold all but the first until the client's delayed ACK).
+*               Returns how many were accepted, with their peer's address.
+*               Out of file descriptors, the rest are hung up on.
+******************************************************************************/
+int Listener::acceptAll(int listenFD, vector<Accepted>& accepted)
+{
+   if (spareFD == ERROR_BAD) // it could not be taken back last time
+      spareFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+   int count = 0;
+   while (true)
+   {
+      Accepted client;
+      socklen_t length = sizeof(client.address);
+      memset(&client.address, 0, sizeof(client.address));
+
+      client.fd = accept4(listenFD, (struct sockaddr*)&client.address, &length,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (client.fd != ERROR_BAD)
+      {
+         if (client.address.ss_family != AF_UNIX)
+         {
+            int on = 1;
+            setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+         }
+         accepted.push_back(client);
+         count++;
+      }
+      else if (errno == EINTR || errno == ECONNABORTED)
+         continue; // that one gave up while queued, the rest still count
+      else if ((errno == EMFILE || errno == ENFILE) && dropPending(listenFD))
+         continue;
+      else
+      {
+         // EAGAIN: drained. Anything else retries next wakeup
+         if (errno != EAGAIN && errno != EWOULDBLOCK)
+            LOG_WARN("error on accept: {}", strerror(errno));
+         break;
+      }
+   }
+   return count;
+}
+
+/******************************************************************************
+* dropPending() - out of file descriptors: a connection left pending keeps
+*                 the welcome socket readable, and the server would spin on
+*                 it. Frees the spare fd to accept the connection, hangs up
+*                 on it, and takes the spare back. Warns at most once every
+*                 FD_WARNING_INTERVAL. Returns false if there was no spare.
+******************************************************************************/
+bool Listener::dropPending(int listenFD)
+{
+   if (spareFD == ERROR_BAD)
+      return false;
+
+   close(spareFD);
+   int fd = accept4(listenFD, NULL, NULL, SOCK_CLOEXEC);
+   if (fd != ERROR_BAD)
+   {
+      close(fd);
+      dropped++;
+   }
+   spareFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+   long long now = now_ms();
+   if (fd != ERROR_BAD && now - warned >= FD_WARNING_INTERVAL)
+   {
+      LOG_WARN("Out of file descriptors, hung up on a connection "
+               "({} so far)", dropped);
+      warned = now;
+   }
+   return (fd != ERROR_BAD);
+}
+
+/******************************************************************************
+* getPort() - the port the welcome socket is bound to (useful with port 0)
+******************************************************************************/
+int Listener::getPort(int listenFD) const
+{
+   struct sockaddr_storage address;
+   socklen_t length = sizeof(address);
+   if (getsockname(listenFD, (struct sockaddr*)&address, &length) != ERROR_OK)
+      return ERROR_BAD;
+
+   if (address.ss_family == AF_INET)
+      return ntohs(((struct sockaddr_in*)&address)->sin_port);
+   if (address.ss_family == AF_INET6)
+      return ntohs(((struct sockaddr_in6*)&address)->sin6_port);
+   return ERROR_BAD;
+}
@@ -0,0 +1,57 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <string>
+#include <sys/socket.h> // sockaddr_storage
+#include <vector>
+#include "constants.h"
+
+/******************************************************************************
+* an accepted connection
+******************************************************************************/
+struct Accepted
+{
+   int fd;
+   struct sockaddr_storage address; // the peer's. AF_UNIX for a local client
+};
+
+/******************************************************************************
+* Listener Class - the server's welcome sockets. Each address added is bound
+*   and listened on (non-blocking), and a wakeup on any of them accepts every
+*   connection that is pending on it, not just the first one. Out of file
+*   descriptors, it hangs up on the pending connections with a spare one it
+*   keeps for that, rather than leave them queued (and the socket readable).
+*   Addresses:
+*     PORT  or  *:PORT     - every interface, IPv6 and IPv4 (dual stack)
+*     HOST:PORT            - a hostname or IPv4 address
+*     [IPV6]:PORT          - an IPv6 address
+*     unix:PATH            - a Unix domain socket bound at PATH
+******************************************************************************/
+class Listener
+{
+   public:
+      Listener(int backlog = DEFAULT_BACKLOG, bool reusePort = false);
+      ~Listener();
+      void add(const char* address); // exits on failure, like the server
+      int acceptAll(int listenFD, std::vector<Accepted>& accepted);
+      const std::vector<int>& getFDs() const { return fds; }
+      int getPort(int listenFD) const;
+      long long getDropped() const { return dropped; }
+
+   private:
+      int backlog;    // length of the kernel's queue of pending connections
+      bool reusePort; // SO_REUSEPORT, so several servers can share a port
+      std::vector<int> fds; // the listening sockets
+      std::vector<std::string> unixPaths; // removed when the listener closes
+      int spareFD;       // given up to accept() when out of file descriptors
+      long long dropped; // connections hung up on for lack of fds
+      long long warned;  // now_ms() of the last warning about it
+
+      void addUnix(const char* path);
+      void addInet(const char* host, const char* port);
+      int bindAll(const char* host, const char* port, int family);
+      void startListening(int fd, const std::string& address);
+      bool dropPending(int listenFD);
+};
+
+#endif
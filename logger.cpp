@@ -0,0 +1,370 @@
+#include <cstdio>   // snprintf
+#include <cstdlib>  // atexit
+#include <ctime>    // clock_gettime, localtime_r, strftime
+#include <pthread.h>
+#include <unistd.h> // write, getpid, usleep
+#include <vector>
+#include "logger.h"
+
+const int LOG_FLUSH_US = 100; // how often log_flush() checks on the writer
+
+/******************************************************************************
+* the ring of one thread. The thread is the only producer, the background
+* writer the only consumer
+******************************************************************************/
+struct LogRing
+{
+   alignas(64) std::atomic<unsigned> head; // next record written
+   alignas(64) std::atomic<unsigned> tail; // next record read
+   LogRecord records[LOG_RING_SIZE];
+};
+
+static pthread_mutex_t ringsLock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<LogRing*> rings; // every thread's ring, under ringsLock
+static thread_local LogRing* myRing = NULL;
+
+static std::atomic<int> minLevel(LEVEL_INFO);
+static std::atomic<long long> dropped(0);
+static std::atomic<bool> running(false); // the writer should keep going
+static std::atomic<bool> writing(false); // the writer holds unwritten text
+static std::atomic<bool> sleeping(false); // the writer waits for the bell
+// the bell. Not an fd: a process that closes every fd it does not know
+// about (see Server::spawnWorker()) would silence it, or worse
+static pthread_mutex_t bellLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bell = PTHREAD_COND_INITIALIZER;
+static bool rung = false; // under bellLock
+static bool started = false; // the writer was started, under ringsLock
+static pthread_t writer;
+static int pid = 0;
+
+static void* writerLoop(void*);
+
+/******************************************************************************
+* wakeWriter() - rings the bell if the writer went to sleep. Only the first
+*                caller after it fell asleep pays for the lock and signal
+******************************************************************************/
+static void wakeWriter()
+{
+   if (sleeping.load() && sleeping.exchange(false))
+   {
+      pthread_mutex_lock(&bellLock);
+      rung = true;
+      pthread_cond_signal(&bell);
+      pthread_mutex_unlock(&bellLock);
+   }
+}
+
+/******************************************************************************
+* log_set_level() / log_get_level() - records below the level are skipped
+******************************************************************************/
+void log_set_level(int level)
+{
+   minLevel.store(level, std::memory_order_relaxed);
+}
+
+int log_get_level()
+{
+   return minLevel.load(std::memory_order_relaxed);
+}
+
+/******************************************************************************
+* log_dropped() - how many records were lost so far
+******************************************************************************/
+long long log_dropped()
+{
+   return dropped.load(std::memory_order_relaxed);
+}
+
+/******************************************************************************
+* log_now() - wall clock time, in nanoseconds
+******************************************************************************/
+long long log_now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/******************************************************************************
+* log_allow() - the rate limit of a call site: up to LOG_RATE_LIMIT records
+*               per second, the rest are dropped
+******************************************************************************/
+bool log_allow(LogLimit& limit, long long ns)
+{
+   long long second = ns / 1000000000LL;
+   long long current = limit.second.load(std::memory_order_relaxed);
+   if (second != current &&
+       limit.second.compare_exchange_strong(current, second))
+      limit.count.store(0, std::memory_order_relaxed);
+
+   if (limit.count.fetch_add(1, std::memory_order_relaxed) < LOG_RATE_LIMIT)
+      return true;
+
+   dropped.fetch_add(1, std::memory_order_relaxed);
+   wakeWriter(); // so the drop gets reported
+   return false;
+}
+
+/******************************************************************************
+* log_stop() - at exit: lets the writer write everything out, then stops it
+******************************************************************************/
+static void log_stop()
+{
+   pthread_mutex_lock(&ringsLock);
+   bool wasStarted = started;
+   started = false;
+   pthread_mutex_unlock(&ringsLock);
+
+   if (wasStarted)
+   {
+      running.store(false);
+      wakeWriter();
+      pthread_join(writer, NULL);
+   }
+}
+
+/******************************************************************************
+* fork handlers - the child has no writer thread, and its copy of the rings
+*                 holds records the parent will write itself. The bell may
+*                 have been held by another thread, so it is made anew
+******************************************************************************/
+static void beforeFork()
+{
+   pthread_mutex_lock(&ringsLock);
+}
+
+static void afterForkParent()
+{
+   pthread_mutex_unlock(&ringsLock);
+}
+
+static void afterForkChild()
+{
+   pid = getpid();
+   for (size_t i = 0; i < rings.size(); i++)
+      rings[i]->tail.store(rings[i]->head.load());
+   writing.store(false);
+   sleeping.store(false);
+   pthread_mutex_init(&bellLock, NULL);
+   pthread_cond_init(&bell, NULL);
+   rung = false;
+
+   if (started)
+      pthread_create(&writer, NULL, writerLoop, NULL);
+   pthread_mutex_unlock(&ringsLock);
+}
+
+/******************************************************************************
+* log_claim() - returns the next free record of this thread's ring, NULL if
+*               the ring is full. The first call of a thread sets up its ring
+*               (and the first call of the process starts the writer).
+******************************************************************************/
+LogRecord* log_claim()
+{
+   if (!myRing)
+   {
+      LogRing* ring = new LogRing;
+      ring->head.store(0);
+      ring->tail.store(0);
+
+      pthread_mutex_lock(&ringsLock);
+      rings.push_back(ring);
+      if (!started)
+      {
+         pid = getpid();
+         running.store(true);
+         pthread_create(&writer, NULL, writerLoop, NULL);
+         started = true;
+
+         static bool registered = false;
+         if (!registered)
+         {
+            pthread_atfork(beforeFork, afterForkParent, afterForkChild);
+            atexit(log_stop);
+            registered = true;
+         }
+      }
+      pthread_mutex_unlock(&ringsLock);
+      myRing = ring;
+   }
+
+   unsigned head = myRing->head.load(std::memory_order_relaxed);
+   if (head - myRing->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE)
+   {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      wakeWriter();
+      return NULL;
+   }
+   return &myRing->records[head & (LOG_RING_SIZE - 1)];
+}
+
+/******************************************************************************
+* log_publish() - hands the claimed record over to the writer, and wakes it
+*                 up if it went to sleep. The store and the check of the
+*                 writer are both sequentially consistent, so either it sees
+*                 the record before it sleeps, or this sees it asleep
+******************************************************************************/
+void log_publish()
+{
+   myRing->head.store(myRing->head.load(std::memory_order_relaxed) + 1);
+   wakeWriter();
+}
+
+/******************************************************************************
+* format() - appends the record, as text, to out
+******************************************************************************/
+static void format(const LogRecord& record, std::string& out)
+{
+   static const char* LEVELS[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+   char buffer[64];
+
+   time_t seconds = record.ns / 1000000000LL;
+   struct tm local;
+   localtime_r(&seconds, &local);
+   strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local);
+   out += buffer;
+   snprintf(buffer, sizeof(buffer), ".%06d %s [%d] ",
+            (int)(record.ns % 1000000000LL / 1000), LEVELS[record.level], pid);
+   out += buffer;
+
+   int arg = 0;
+   for (const char* c = record.fmt; *c; c++)
+   {
+      if (c[0] != '{' || c[1] != '}' || arg >= record.nargs)
+      {
+         out += *c;
+         continue;
+      }
+
+      const LogArg& value = record.args[arg++];
+      if (value.type == LogArg::INT)
+         snprintf(buffer, sizeof(buffer), "%lld", value.i);
+      else if (value.type == LogArg::UINT)
+         snprintf(buffer, sizeof(buffer), "%llu", value.u);
+      else if (value.type == LogArg::DOUBLE)
+         snprintf(buffer, sizeof(buffer), "%g", value.d);
+      out += (value.type == LogArg::STRING ? value.s : buffer);
+      c++; // skip the '}'
+   }
+   out += '\n';
+}
+
+/******************************************************************************
+* drain() - formats every record waiting in the rings. Returns how many
+******************************************************************************/
+static int drain(std::string& out)
+{
+   int count = 0;
+   pthread_mutex_lock(&ringsLock);
+   for (size_t i = 0; i < rings.size(); i++)
+   {
+      LogRing* ring = rings[i];
+      unsigned tail = ring->tail.load(std::memory_order_relaxed);
+      unsigned head = ring->head.load(std::memory_order_acquire);
+      for (; tail != head; tail++, count++)
+         format(ring->records[tail & (LOG_RING_SIZE - 1)], out);
+      ring->tail.store(tail, std::memory_order_release);
+   }
+   pthread_mutex_unlock(&ringsLock);
+   return count;
+}
+
+/******************************************************************************
+* sleepUntilLogged() - the writer has nothing to do: sleeps on the bell until
+*                      a record is published, a record is dropped, or the
+*                      logger stops. Checks once more after asking for the
+*                      bell, so a record that raced with it is not missed
+******************************************************************************/
+static void sleepUntilLogged(long long reported)
+{
+   sleeping.store(true);
+
+   bool idle = running.load() && dropped.load() == reported;
+   pthread_mutex_lock(&ringsLock);
+   for (size_t i = 0; idle && i < rings.size(); i++)
+      idle = (rings[i]->head.load() == rings[i]->tail.load());
+   pthread_mutex_unlock(&ringsLock);
+
+   if (!idle)
+   {
+      sleeping.store(false);
+      return;
+   }
+
+   pthread_mutex_lock(&bellLock);
+   while (!rung)
+      pthread_cond_wait(&bell, &bellLock);
+   rung = false;
+   pthread_mutex_unlock(&bellLock);
+}
+
+/******************************************************************************
+* writerLoop() - the background writer. Formats and writes out the records,
+*                and reports the ones that were dropped
+******************************************************************************/
+static void* writerLoop(void*)
+{
+   std::string out;
+   long long reported = dropped.load();
+
+   while (true)
+   {
+      bool stopping = !running.load();
+      writing.store(true);
+      int count = drain(out);
+
+      long long lost = dropped.load(std::memory_order_relaxed);
+      if (lost != reported)
+      {
+         LogRecord record;
+         record.ns = log_now();
+         record.level = LEVEL_WARN;
+         record.fmt = "logger: {} records dropped so far";
+         record.nargs = 0;
+         log_pack(record, lost);
+         format(record, out);
+         reported = lost;
+      }
+
+      for (size_t sent = 0; sent < out.size(); )
+      {
+         ssize_t n = write(STDOUT_FILENO, out.data() + sent, out.size() - sent);
+         if (n <= 0)
+            break;
+         sent += n;
+      }
+      out.clear();
+      writing.store(false);
+
+      if (!count)
+      {
+         if (stopping)
+            break;
+         sleepUntilLogged(reported);
+      }
+   }
+   return NULL;
+}
+
+/******************************************************************************
+* log_flush() - blocks until everything logged so far has been written
+******************************************************************************/
+void log_flush()
+{
+   while (true)
+   {
+      // the rings first: once they are empty, the writer may still be
+      // holding their text
+      bool empty = true;
+      pthread_mutex_lock(&ringsLock);
+      for (size_t i = 0; empty && i < rings.size(); i++)
+         empty = (rings[i]->head.load() == rings[i]->tail.load());
+      bool alive = started;
+      pthread_mutex_unlock(&ringsLock);
+      empty = empty && !writing.load();
+
+      if (empty || !alive)
+         return;
+      usleep(LOG_FLUSH_US);
+   }
+}
@@ -0,0 +1,133 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <string>
+
+/******************************************************************************
+* LOGGER - asynchronous logging for the server.
+*   LOG_INFO("match started: '{}' vs '{}'", p1->name, p2->name);
+*   The calling thread only copies the format (which must be a string
+*   literal) and the arguments, in binary, into its own lock free ring. A
+*   background thread formats the records (each {} takes the next argument)
+*   and writes them out. Nothing on the calling side locks, formats or
+*   flushes. When the ring is full, or a call site logs more than
+*   LOG_RATE_LIMIT records in a second, the record is dropped and counted.
+******************************************************************************/
+enum logLevels { LEVEL_DEBUG, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR };
+
+const int LOG_MAX_ARGS = 4;      // arguments kept per record
+const int LOG_MAX_STRING = 32;   // longer string arguments are cut
+const int LOG_RING_SIZE = 4096;  // records per thread, a power of 2
+const int LOG_RATE_LIMIT = 1000; // records per call site per second
+
+// one argument of a record
+struct LogArg
+{
+   enum { INT, UINT, DOUBLE, STRING } type;
+   union
+   {
+      long long i;
+      unsigned long long u;
+      double d;
+      char s[LOG_MAX_STRING];
+   };
+};
+
+// one record, as it sits in the ring
+struct LogRecord
+{
+   long long ns; // CLOCK_REALTIME, in nanoseconds
+   int level;
+   const char* fmt;
+   int nargs;
+   LogArg args[LOG_MAX_ARGS];
+};
+
+// the rate limit of one call site
+struct LogLimit
+{
+   std::atomic<long long> second; // the second being counted
+   std::atomic<int> count;        // records logged in that second
+};
+
+void log_set_level(int level);
+int log_get_level();
+long long log_dropped();  // records lost to a full ring or the rate limit
+void log_flush();         // wait until everything logged so far is written
+
+// used by the macros
+long long log_now();
+bool log_allow(LogLimit& limit, long long ns);
+LogRecord* log_claim();
+void log_publish();
+
+inline void log_set(LogArg& arg, long long value)
+{ arg.type = LogArg::INT; arg.i = value; }
+inline void log_set(LogArg& arg, int value) { log_set(arg, (long long)value); }
+inline void log_set(LogArg& arg, long value) { log_set(arg, (long long)value); }
+inline void log_set(LogArg& arg, unsigned long long value)
+{ arg.type = LogArg::UINT; arg.u = value; }
+inline void log_set(LogArg& arg, unsigned value)
+{ log_set(arg, (unsigned long long)value); }
+inline void log_set(LogArg& arg, unsigned long value)
+{ log_set(arg, (unsigned long long)value); }
+inline void log_set(LogArg& arg, double value)
+{ arg.type = LogArg::DOUBLE; arg.d = value; }
+inline void log_set(LogArg& arg, const char* value)
+{
+   arg.type = LogArg::STRING;
+   int i = 0;
+   for (; value && value[i] && i < LOG_MAX_STRING - 1; i++)
+      arg.s[i] = value[i];
+   arg.s[i] = '\0';
+}
+inline void log_set(LogArg& arg, const std::string& value)
+{ log_set(arg, value.c_str()); }
+
+inline void log_pack(LogRecord&) {}
+
+template <typename T, typename... Rest>
+inline void log_pack(LogRecord& record, const T& value, const Rest&... rest)
+{
+   if (record.nargs < LOG_MAX_ARGS)
+      log_set(record.args[record.nargs++], value);
+   log_pack(record, rest...);
+}
+
+template <typename... Args>
+void log_write(int level, LogLimit& limit, const char* fmt,
+               const Args&... args)
+{
+   long long ns = log_now();
+   if (!log_allow(limit, ns))
+      return;
+
+   LogRecord* record = log_claim();
+   if (!record)
+      return;
+
+   record->ns = ns;
+   record->level = level;
+   record->fmt = fmt;
+   record->nargs = 0;
+   log_pack(*record, args...);
+   log_publish();
+}
+
+#define LOG_AT(level, ...)                                \
+   do                                                     \
+   {                                                      \
+      if ((level) >= log_get_level())                     \
+      {                                                   \
+         static LogLimit logLimit_;                       \
+         log_write((level), logLimit_, __VA_ARGS__);      \
+      }                                                   \
+   } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LEVEL_ERROR, __VA_ARGS__)
+
+#endif
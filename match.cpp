@@ -0,0 +1,411 @@
+#include <cstring>  // strcpy, strcmp
+#include <sys/socket.h> // shutdown
+#include <unistd.h> // close
+#include "constants.h"
+#include "helpers.h"
+#include "logger.h"
+#include "match.h"
+#include "transport.h"
+
+using namespace std;
+
+/******************************************************************************
+* Match constructor
+******************************************************************************/
+Match::Match(Player* p1, Player* p2) : over(false)
+{
+   players[0] = p1;
+   players[1] = p2;
+   choices[0] = choices[1] = '\0';
+   gone[0] = gone[1] = false;
+   wins[0] = wins[1] = rounds = 0;
+   quitter = -1;
+   p1->isPlaying = true;
+   p2->isPlaying = true;
+
+   // never block on a player, whatever can't be sent right away is queued
+   for (int i = 0; i < 2; i++)
+   {
+      if (!players[i]->isBot)
+         transport_queue_writes(players[i]->clientFD);
+   }
+}
+
+/******************************************************************************
+* Match destructor - hangs up on the players, after a last try at sending
+*                    them what is still queued
+******************************************************************************/
+Match::~Match()
+{
+   for (int i = 0; i < 2; i++)
+   {
+      if (!players[i]->isBot)
+      {
+         if (!gone[i])
+            transport_flush(players[i]->clientFD);
+         transport_close(players[i]->clientFD);
+         shutdown(players[i]->clientFD, SHUT_RDWR);
+         close(players[i]->clientFD);
+      }
+      delete players[i];
+   }
+}
+
+/******************************************************************************
+* start() - lets the players know who their opponents are, then starts the
+*           first round
+******************************************************************************/
+void Match::start()
+{
+   Player* p1 = players[0];
+   Player* p2 = players[1];
+
+   LOG_INFO("Starting a game - Players: '{}' VS '{}'", p1->name, p2->name);
+
+   // let the players know who their oponents are
+   sendTo(p1, SET_OPPONENT);
+   sendTo(p2, SET_OPPONENT);
+   sendTo(p1, p2->name);
+   sendTo(p2, p1->name);
+
+   startRound();
+}
+
+/******************************************************************************
+* startRound() - sends a TURN command to the players
+*  The TURN code means that the Server expects an input from the players.
+*  Valid Inputs are: r/p/s/q for Rock, Paper, Scissors, Quit
+*  The bot's input comes straight from its predictor.
+******************************************************************************/
+void Match::startRound()
+{
+   for (int i = 0; i < 2; i++)
+   {
+      choices[i] = '\0';
+      ping(players[i]); // the client answers it before it prompts the user
+      sendTo(players[i], TURN);
+      if (players[i]->isBot)
+         choices[i] = bot.choose();
+   }
+}
+
+/******************************************************************************
+* onReadable() - handles every frame of the player that arrived whole. The
+*                bytes of a partial frame wait for the rest, so a player
+*                that sends half a frame holds up nobody. A player that hung
+*                up quits.
+******************************************************************************/
+void Match::onReadable(int fd)
+{
+   char buffer[MAXLEN] = "";
+   int i = (players[0]->clientFD == fd ? 0 : 1);
+   int length;
+
+   while (!over && (length = read_frame(fd, buffer)) != 0)
+   {
+      if (length == ERROR_BAD)
+      {
+         buffer[0] = QUIT;
+         buffer[1] = '\0';
+      }
+      onFrame(i, buffer);
+   }
+}
+
+/******************************************************************************
+* onFrame() - the player's input for this turn. Once both inputs are in, the
+*             round is over; a quit ends the game right away, without
+*             waiting on the other one. PING and PONG can come in at any
+*             time, and are not inputs. Neither is anything else that is not
+*             a single r/p/s/q.
+******************************************************************************/
+void Match::onFrame(int i, const char* buffer)
+{
+   if (strcmp(buffer, PING) == 0)
+   {
+      sendTo(players[i], PONG);
+      return;
+   }
+   else if (strcmp(buffer, PONG) == 0)
+   {
+      players[i]->rtt.ponged(now_us());
+      return;
+   }
+   else if (buffer[1] != '\0' ||
+            (buffer[0] != ROCK && buffer[0] != PAPER &&
+             buffer[0] != SCISSOR && buffer[0] != QUIT))
+   {
+      // not an input, e.g. a lobby command that crossed the game's start
+      LOG_DEBUG("Ignored '{}' from '{}'", buffer, players[i]->name);
+      return;
+   }
+
+   if (!choices[i])
+      choices[i] = buffer[0];
+
+   if (buffer[0] == QUIT)
+   {
+      if (quitter == -1)
+         quitter = i;
+      end();
+   }
+   else if (choices[0] && choices[1])
+      finishRound();
+}
+
+/******************************************************************************
+* checkPeers() - ends the game if a player hung up on a write, or stopped
+*                reading for so long that its transport gave up on it. The
+*                opponent gets the usual PDC.
+******************************************************************************/
+void Match::checkPeers()
+{
+   for (int i = 0; i < 2; i++)
+   {
+      if (!players[i]->isBot && !gone[i] &&
+          transport_failed(players[i]->clientFD))
+         gone[i] = true;
+   }
+
+   if (!over && (gone[0] || gone[1]))
+   {
+      LOG_INFO("Dropping '{}', the player is gone or too slow",
+               players[gone[0] ? 0 : 1]->name);
+      if (quitter == -1)
+         quitter = (gone[0] ? 0 : 1);
+      end();
+   }
+}
+
+/******************************************************************************
+* probe() - pings the players that sent their input and are now waiting on
+*           their opponent: their client is idle, so it answers at once
+******************************************************************************/
+void Match::probe()
+{
+   for (int i = 0; i < 2 && !over; i++)
+   {
+      if (choices[i] && !choices[1 - i])
+         ping(players[i]);
+   }
+}
+
+/******************************************************************************
+* finishRound() - acts upon the player's inputs
+******************************************************************************/
+void Match::finishRound()
+{
+   Player* p1 = players[0];
+   Player* p2 = players[1];
+   char p1Choice = choices[0];
+   char p2Choice = choices[1];
+   char buffer1[MAXLEN] = "";
+   char buffer2[MAXLEN] = "";
+
+   // let the bot learn from whoever it is playing against
+   if (p1->isBot)
+      bot.observe(p2Choice);
+   else if (p2->isBot)
+      bot.observe(p1Choice);
+
+   // a player quit (or hung up), the game is over
+   if (p1Choice == QUIT || p2Choice == QUIT)
+   {
+      if (quitter == -1)
+         quitter = (p1Choice == QUIT ? 0 : 1);
+      end();
+      return;
+   }
+
+   // the inputs were either PAPER, ROCK or SCISSORS
+   // so compute the winner and send the results to the clients
+   int roundResult = getRoundResult(p1Choice, p2Choice);
+   switch(roundResult)
+   {
+      case TIE :
+         sendTo(p1, DRAW);
+         sendTo(p2, DRAW);
+         rounds++;
+         break;
+      case P1 :
+         sendTo(p1, WIN);
+         sendTo(p2, LOSS);
+         wins[0]++;
+         rounds++;
+         break;
+      case P2 :
+         sendTo(p1, LOSS);
+         sendTo(p2, WIN);
+         wins[1]++;
+         rounds++;
+         break;
+      default:
+         LOG_ERROR("Error calculating the round result!");
+   }
+   // now that the DRAW / WIN LOSS was sent, build a nice string and
+   // send it to both clients
+   buildVerboseResult(p1Choice, p2Choice, buffer1, roundResult);
+   buildVerboseResult(p2Choice, p1Choice, buffer2, flip(roundResult));
+   sendTo(p1, buffer1);
+   sendTo(p2, buffer2);
+
+   startRound();
+}
+
+/******************************************************************************
+* end() - lets both players know the game is over
+******************************************************************************/
+void Match::end()
+{
+   sendTo(players[0], DC);
+   sendTo(players[1], DC);
+   over = true;
+   LOG_INFO("Game over - '{}' VS '{}'", players[0]->name, players[1]->name);
+
+   for (int i = 0; i < 2; i++)
+   {
+      const RttProbe& rtt = players[i]->rtt;
+      if (rtt.isKnown())
+         LOG_DEBUG("RTT to '{}': {} us, +/- {} us",
+                   players[i]->name, rtt.getSmoothed(), rtt.getVariation());
+   }
+}
+
+/******************************************************************************
+* getResult() - who won the match: whoever won the most rounds. P1, P2, TIE,
+*               or NO_CONTEST if no round was played. A quit never pays:
+*               the player that quit loses, or the match is no contest if
+*               it was ahead (else leaving while ahead locks a win in).
+******************************************************************************/
+int Match::getResult() const
+{
+   if (!rounds)
+      return NO_CONTEST;
+   if (quitter != -1)
+   {
+      if (wins[quitter] > wins[1 - quitter])
+         return NO_CONTEST;
+      return (quitter == 0 ? P2 : P1);
+   }
+   if (wins[0] == wins[1])
+      return TIE;
+   return (wins[0] > wins[1] ? P1 : P2);
+}
+
+/******************************************************************************
+* getFDs() - the sockets of the (non bot) players, while the game is on
+******************************************************************************/
+void Match::getFDs(vector<int>& fds) const
+{
+   for (int i = 0; i < 2 && !over; i++)
+   {
+      if (!players[i]->isBot)
+         fds.push_back(players[i]->clientFD);
+   }
+}
+
+/******************************************************************************
+* sendTo() - sends the message to the player. The bot has no socket, so
+*            anything sent to it is dropped, and so is anything sent to a
+*            player that is gone.
+******************************************************************************/
+void Match::sendTo(Player* player, const char* msg)
+{
+   int i = (player == players[0] ? 0 : 1);
+
+   if (!player->isBot && !gone[i] &&
+       write_data(player->clientFD, msg) == ERROR_BAD)
+      gone[i] = true;
+}
+
+/******************************************************************************
+* ping() - sends the player a PING, if one is due. The bot has no round trip.
+******************************************************************************/
+void Match::ping(Player* player)
+{
+   long long now = now_us();
+   if (!player->isBot && player->rtt.isDue(now))
+   {
+      player->rtt.pinged(now);
+      sendTo(player, PING);
+   }
+}
+
+/******************************************************************************
+* given the inputs ROCK / PAPER / SCISSOR for each player, return
+* the winner of that round.
+* possible outputs are: P1 / TIE / P2
+******************************************************************************/
+int Match::getRoundResult(char p1Choice, char p2Choice)
+{
+   int result = -99;
+
+   if (p1Choice == ROCK)
+   {
+      if      (p2Choice == ROCK)    result = TIE;
+      else if (p2Choice == PAPER)   result = P2;
+      else if (p2Choice == SCISSOR) result = P1;
+   }
+   else if (p1Choice == PAPER)
+   {
+      if      (p2Choice == ROCK)    result = P1;
+      else if (p2Choice == PAPER)   result = TIE;
+      else if (p2Choice == SCISSOR) result = P2;
+   }
+   else if (p1Choice == SCISSOR)
+   {
+      if      (p2Choice == ROCK)    result = P2;
+      else if (p2Choice == PAPER)   result = P1;
+      else if (p2Choice == SCISSOR) result = TIE;
+   }
+   return result;
+}
+
+/******************************************************************************
+* buildVerboseResult() - builds a string
+******************************************************************************/
+void Match::buildVerboseResult(char p1Choice, char p2Choice,
+                                char* buffer, int result)
+{
+   string msg;
+   string choice1 = getVerboseChoice(p1Choice);
+   string choice2 = getVerboseChoice(p2Choice);
+
+   if (result == TIE)
+      msg = choice1 + " TIES against " + choice2 + "! Round DRAW!\n";
+   else if(result == P1)
+      msg = choice1 + " beats " + choice2 + "! You WIN!\n";
+   else if (result == P2)
+      msg = choice1 + " is beaten by " + choice2 + "! You LOSE!\n";
+   else
+   {
+      LOG_ERROR("Invalid player choice! This should not have happened! "
+                "The result was: {}", result);
+   }
+
+   strcpy(buffer, msg.c_str()); // put the string into the buffer
+}
+
+/******************************************************************************
+* getVerboseChoice() - returns the string representation of the choice
+*  'r' -> "ROCK"
+*  'p' -> "PAPER
+*  's' -> "SCISSORS"
+******************************************************************************/
+string Match::getVerboseChoice(char choice)
+{
+   if (choice == ROCK) return "ROCK";
+   return (choice == PAPER ? "PAPER" : "SCISSORS");
+}
+
+/******************************************************************************
+* flip() - flips the result - if P1 won, return P2, vice-versa...
+******************************************************************************/
+int Match::flip(int result)
+{
+   int flippedResult = -99;
+   if (result == P1)       flippedResult = P2;
+   else if (result == P2)  flippedResult = P1;
+   else if (result == TIE) flippedResult = TIE;
+   return flippedResult;
+}
@@ -0,0 +1,56 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <string>
+#include <vector>
+#include "bot.h"
+#include "player.h"
+
+/******************************************************************************
+* Match Class - the game between 2 players, as a state machine. It never
+*   blocks waiting on a player: whoever runs it polls the players' sockets
+*   and calls onReadable() when one of them sent something. That way one
+*   process can run many matches at once (see Worker). Writes to the players
+*   are queued, so a player that stops reading only stalls its own match;
+*   checkPeers() drops it once its transport gives up on it. The players'
+*   round trip times are probed while they wait (see probe()).
+******************************************************************************/
+class Match
+{
+   public:
+      Match(Player* p1, Player* p2); // the match deletes the players
+      ~Match();
+      void start();
+      void onReadable(int fd);
+      void checkPeers();
+      void probe();
+      bool isOver() const { return over; }
+      void getFDs(std::vector<int>& fds) const;
+      const Player* getPlayer(int i) const { return players[i]; }
+      int getResult() const;
+
+   private:
+      Player* players[2];
+      char choices[2]; // the inputs for this round, '\0' until received
+      Bot bot;         // plays for whichever player is the server's bot
+      bool over;
+      bool gone[2];    // the player hung up, or was too slow to keep
+      int wins[2];     // rounds won by each player
+      int rounds;      // rounds played
+      int quitter;     // the player that quit (or hung up, or was dropped)
+                       // first, -1 if none
+
+      void onFrame(int i, const char* buffer);
+      void startRound();
+      void finishRound();
+      void end();
+      void sendTo(Player* player, const char* msg);
+      void ping(Player* player);
+      int getRoundResult(char p1Choice, char p2Choice);
+      void buildVerboseResult(char p1Choice, char p2Choice,
+                              char* buffer, int result);
+      std::string getVerboseChoice(char choice);
+      int flip(int result);
+};
+
+#endif
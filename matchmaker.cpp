@@ -0,0 +1,205 @@
+#include "helpers.h" // now_us
+#include "logger.h"
+#include "matchmaker.h"
+
+using namespace std;
+
+const int RATING_BUCKET = 50;    // rating points per queue
+const int BUCKETS = 80;          // ratings 0 to 4000
+const int WIDEN_INTERVAL = 2000; // ms waited per extra bucket on each side
+const int WAIT_SLOTS = 20;       // waits of up to 2^19 ms (~9 minutes)
+
+/******************************************************************************
+* Matchmaker constructor
+******************************************************************************/
+Matchmaker::Matchmaker(long long (*clock)())
+   : buckets(BUCKETS), nextID(0), clock(clock), waits(WAIT_SLOTS, 0),
+     slowestPairing(0)
+{
+}
+
+/******************************************************************************
+* add() - queues the player in its rating's bucket. It is looked at right
+*         away, on the next pair().
+******************************************************************************/
+void Matchmaker::add(Player* player)
+{
+   if (tickets.count(player))
+      return;
+
+   int bucket = (int)(player->rating / RATING_BUCKET);
+   bucket = (bucket < 0 ? 0 : (bucket >= BUCKETS ? BUCKETS - 1 : bucket));
+
+   Ticket& ticket = tickets[player];
+   ticket.id = nextID++;
+   ticket.bucket = bucket;
+   ticket.queuedAt = clock();
+   ticket.bucketPos = buckets[bucket].insert(buckets[bucket].end(), player);
+   ticket.arrivalPos = arrivals.insert(arrivals.end(), player);
+
+   Due next = { ticket.queuedAt, player, ticket.id };
+   due.push(next);
+}
+
+/******************************************************************************
+* remove() - takes the player out of the queue. If it is because it got a
+*            game, its wait goes into the histogram.
+******************************************************************************/
+void Matchmaker::remove(Player* player, bool served)
+{
+   unordered_map<Player*, Ticket>::iterator it = tickets.find(player);
+   if (it == tickets.end())
+      return;
+
+   if (served)
+   {
+      long long wait = clock() - it->second.queuedAt;
+      int slot = 0;
+      while (slot < WAIT_SLOTS - 1 && wait >= (1LL << slot))
+         slot++;
+      waits[slot]++;
+   }
+
+   buckets[it->second.bucket].erase(it->second.bucketPos);
+   arrivals.erase(it->second.arrivalPos);
+   tickets.erase(it); // its Due entries are dropped when they come up
+}
+
+/******************************************************************************
+* pair() - looks at the players whose window just widened (or who just
+*          came in), until one of them finds an opponent
+******************************************************************************/
+bool Matchmaker::pair(Player*& p1, Player*& p2)
+{
+   long long start = now_us();
+   long long now = clock();
+   bool found = false;
+
+   while (!found && !due.empty() && due.top().when <= now)
+   {
+      Due next = due.top();
+      due.pop();
+
+      unordered_map<Player*, Ticket>::iterator it = tickets.find(next.player);
+      if (it == tickets.end() || it->second.id != next.id)
+         continue; // that player is gone
+
+      Player* opponent = findOpponent(next.player, now);
+      if (opponent)
+      {
+         // the longest waiting goes first, like the FIFO used to
+         bool older = it->second.queuedAt <= tickets[opponent].queuedAt;
+         p1 = (older ? next.player : opponent);
+         p2 = (older ? opponent : next.player);
+         remove(p1, true);
+         remove(p2, true);
+         found = true;
+      }
+      else if (getWindow(it->second, now) < BUCKETS)
+      {
+         int window = getWindow(it->second, now);
+         next.when = it->second.queuedAt + (window + 1) * WIDEN_INTERVAL;
+         due.push(next);
+      }
+   }
+
+   long long spent = now_us() - start;
+   if (spent > slowestPairing)
+      slowestPairing = spent;
+   return found;
+}
+
+/******************************************************************************
+* findOpponent() - the closest candidate in rating that either player's
+*                  window reaches, the oldest one on a tie. NULL if none.
+******************************************************************************/
+Player* Matchmaker::findOpponent(Player* player, long long now)
+{
+   const Ticket& ticket = tickets[player];
+   int window = getWindow(ticket, now);
+
+   for (int distance = 0; distance < BUCKETS; distance++)
+   {
+      Player* best = NULL;
+      long long bestSince = 0;
+      int sides[2] = { ticket.bucket - distance, ticket.bucket + distance };
+
+      for (int i = 0; i < (distance ? 2 : 1); i++)
+      {
+         if (sides[i] < 0 || sides[i] >= BUCKETS || buckets[sides[i]].empty())
+            continue;
+
+         // the oldest of the bucket, unless it is the player itself
+         list<Player*>::iterator candidate = buckets[sides[i]].begin();
+         if (*candidate == player && ++candidate == buckets[sides[i]].end())
+            continue;
+
+         const Ticket& other = tickets[*candidate];
+         if ((distance <= window || distance <= getWindow(other, now)) &&
+             (!best || other.queuedAt < bestSince))
+         {
+            best = *candidate;
+            bestSince = other.queuedAt;
+         }
+      }
+
+      if (best)
+         return best;
+   }
+   return NULL;
+}
+
+/******************************************************************************
+* getWindow() - how many buckets on each side of its own the player reaches
+******************************************************************************/
+int Matchmaker::getWindow(const Ticket& ticket, long long now) const
+{
+   return (int)((now - ticket.queuedAt) / WIDEN_INTERVAL);
+}
+
+/******************************************************************************
+* getNextDue() - clock() of the next time pair() has something to look at,
+*                -1 if never. Can be early: the player may be gone.
+******************************************************************************/
+long long Matchmaker::getNextDue() const
+{
+   return (due.empty() ? -1 : due.top().when);
+}
+
+/******************************************************************************
+* getOldest() - the player that has been waiting the longest
+******************************************************************************/
+Player* Matchmaker::getOldest() const
+{
+   return (arrivals.empty() ? NULL : arrivals.front());
+}
+
+/******************************************************************************
+* logStats() - logs the distribution of the waits since the last call: how
+*              many got a game, and the 50th, 90th and 99th percentiles (the
+*              upper bound of their slot of the histogram)
+******************************************************************************/
+void Matchmaker::logStats()
+{
+   long long served = 0;
+   for (int i = 0; i < WAIT_SLOTS; i++)
+      served += waits[i];
+
+   long long percentiles[3] = { 0, 0, 0 };
+   const int wanted[3] = { 50, 90, 99 };
+   long long seen = 0;
+   for (int i = 0, p = 0; i < WAIT_SLOTS && p < 3; i++)
+   {
+      seen += waits[i];
+      while (p < 3 && served && seen * 100 >= served * wanted[p])
+         percentiles[p++] = (1LL << i);
+   }
+
+   LOG_INFO("Queue: {} waiting, {} served, slowest pairing {} us",
+            size(), served, slowestPairing);
+   LOG_INFO("Queue wait: p50 < {} ms, p90 < {} ms, p99 < {} ms",
+            percentiles[0], percentiles[1], percentiles[2]);
+
+   waits.assign(WAIT_SLOTS, 0);
+   slowestPairing = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef MATCHMAKER_H
+#define MATCHMAKER_H
+
+#include <functional> // greater
+#include <list>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include "helpers.h" // now_ms
+#include "player.h"
+
+/******************************************************************************
+* Matchmaker Class - the players up for a game with anybody, in queues by
+*   rating: one per RATING_BUCKET points. A player's search window starts at
+*   its own bucket, and widens by one bucket on each side every
+*   WIDEN_INTERVAL ms it waits. Two players can be paired once either one's
+*   window reaches the other's bucket.
+*   A player is only looked at when it joins and whenever its window widens,
+*   and then only the oldest player of each bucket is a candidate (its
+*   window is the widest of the bucket): pairing costs O(buckets), however
+*   many players wait.
+*   The wait of every player that got a game is kept in a histogram.
+*   Time is whatever its clock says, now_ms() unless a test gives another.
+******************************************************************************/
+class Matchmaker
+{
+   public:
+      Matchmaker(long long (*clock)() = now_ms);
+      void add(Player* player);
+      void remove(Player* player, bool served = false); // served: got a game
+      bool pair(Player*& p1, Player*& p2); // the next pair, false if none
+      long long getNextDue() const; // clock() when a window widens, or -1
+      Player* getOldest() const;    // the longest waiting, NULL if none
+      size_t size() const { return tickets.size(); }
+      void logStats(); // the waits since the last call, then starts over
+
+   private:
+      struct Ticket
+      {
+         long long id;       // tells a Player* apart from a recycled one
+         int bucket;
+         long long queuedAt; // clock()
+         std::list<Player*>::iterator bucketPos;
+         std::list<Player*>::iterator arrivalPos;
+      };
+
+      struct Due // the next time a player's window widens
+      {
+         long long when;
+         Player* player;
+         long long id;
+         bool operator>(const Due& other) const { return when > other.when; }
+      };
+
+      std::vector<std::list<Player*> > buckets; // oldest first, each
+      std::list<Player*> arrivals;              // oldest first
+      std::unordered_map<Player*, Ticket> tickets;
+      std::priority_queue<Due, std::vector<Due>, std::greater<Due> > due;
+      long long nextID;
+      long long (*clock)(); // ms
+
+      std::vector<long long> waits; // histogram: [i] waited < 2^i ms
+      long long slowestPairing;     // microseconds spent in one pair()
+
+      int getWindow(const Ticket& ticket, long long now) const;
+      Player* findOpponent(Player* player, long long now);
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include <cstdio>   // printf
+#include "matchmaker.h"
+
+// the Matchmaker's clock in these cases, in ms
+static long long fakeNow = 0;
+
+/******************************************************************************
+* fakeClock() - what the cases set the time to
+******************************************************************************/
+static long long fakeClock()
+{
+   return fakeNow;
+}
+
+/******************************************************************************
+* check() - reports a check of a case
+******************************************************************************/
+static bool check(const char* what, bool passed)
+{
+   printf("%-52s %s\n", what, passed ? "ok" : "FAILED");
+   return passed;
+}
+
+/******************************************************************************
+* ratedPlayer() - a player queued at that rating
+******************************************************************************/
+static Player* ratedPlayer(double rating)
+{
+   Player* player = new Player;
+   player->rating = rating;
+   return player;
+}
+
+/******************************************************************************
+* testSameBucket() - 2 players of the same bucket are paired right away, the
+*                    one that waited longest first
+******************************************************************************/
+static bool testSameBucket()
+{
+   fakeNow = 0;
+   Matchmaker queue(fakeClock);
+   Player* first = ratedPlayer(1510);
+   Player* second = ratedPlayer(1540);
+   queue.add(first);
+   fakeNow = 5;
+   queue.add(second);
+
+   Player* p1 = NULL;
+   Player* p2 = NULL;
+   bool passed = check("same bucket: paired right away",
+                       queue.pair(p1, p2) && p1 == first && p2 == second);
+   passed &= check("same bucket: nobody is left", queue.size() == 0 &&
+                   !queue.getOldest() && !queue.pair(p1, p2));
+   delete first;
+   delete second;
+   return passed;
+}
+
+/******************************************************************************
+* testWidening() - 4 buckets apart, 2 players meet once their windows widened
+*                  4 times: not a ms before
+******************************************************************************/
+static bool testWidening()
+{
+   fakeNow = 0;
+   Matchmaker queue(fakeClock);
+   Player* low = ratedPlayer(1500);
+   Player* high = ratedPlayer(1700);
+   queue.add(low);
+   queue.add(high);
+
+   Player* p1 = NULL;
+   Player* p2 = NULL;
+   bool passed = true;
+   for (fakeNow = 0; fakeNow < 8000; fakeNow += 500)
+      passed &= !queue.pair(p1, p2);
+   passed &= check("widening: apart while the windows are narrow", passed);
+
+   fakeNow = 8000;
+   passed &= check("widening: paired once the windows reach",
+                   queue.pair(p1, p2) && p1 == low && p2 == high);
+   delete low;
+   delete high;
+   return passed;
+}
+
+/******************************************************************************
+* testDueOrder() - pair() looks at the players in the order their windows
+*                  widen, and getNextDue() says when the next one does
+******************************************************************************/
+static bool testDueOrder()
+{
+   fakeNow = 0;
+   Matchmaker queue(fakeClock);
+   Player* early = ratedPlayer(1500);
+   Player* far = ratedPlayer(3500);
+   queue.add(early);
+   queue.add(far);
+   fakeNow = 1000;
+   Player* late = ratedPlayer(1700);
+   queue.add(late);
+
+   Player* p1 = NULL;
+   Player* p2 = NULL;
+   bool passed = !queue.pair(p1, p2);
+   passed &= check("due order: the earliest widening is next",
+                   passed && queue.getNextDue() == 2000);
+
+   fakeNow = 2000;
+   passed &= !queue.pair(p1, p2);
+   passed &= check("due order: then the one that came in later",
+                   queue.getNextDue() == 2000 + 1000 &&
+                   !queue.pair(p1, p2) && queue.getNextDue() == 3000);
+
+   // early's window reaches late's bucket at 8000, before late's own
+   // window (at 9000) or anybody's reaches far
+   fakeNow = 7999;
+   passed &= !queue.pair(p1, p2);
+   fakeNow = 8000;
+   passed &= check("due order: the first window to reach pairs",
+                   queue.pair(p1, p2) && p1 == early && p2 == late);
+   passed &= check("due order: the far one keeps waiting",
+                   queue.size() == 1 && queue.getOldest() == far);
+   delete early;
+   delete far;
+   delete late;
+   return passed;
+}
+
+/******************************************************************************
+* testClosest() - of 2 players a window reaches, the closer in rating wins,
+*                 even if it came in later. A removed player is never paired.
+******************************************************************************/
+static bool testClosest()
+{
+   fakeNow = 0;
+   Matchmaker queue(fakeClock);
+   Player* player = ratedPlayer(1500);
+   Player* farther = ratedPlayer(1400);
+   Player* gone = ratedPlayer(1450);
+   queue.add(player);
+   queue.add(farther);
+   fakeNow = 100;
+   Player* closer = ratedPlayer(1550);
+   queue.add(closer);
+   queue.add(gone);
+   queue.remove(gone);
+
+   Player* p1 = NULL;
+   Player* p2 = NULL;
+   fakeNow = 2000;
+   bool passed = check("closest: the closer one, not the older one",
+                       queue.pair(p1, p2) && p1 == player && p2 == closer);
+   passed &= check("closest: a removed player is not paired",
+                   queue.size() == 1 && queue.getOldest() == farther);
+   delete player;
+   delete farther;
+   delete gone;
+   delete closer;
+   return passed;
+}
+
+/******************************************************************************
+* main - the Matchmaker's pairing, on a clock the cases move by hand
+******************************************************************************/
+int main()
+{
+   bool passed = true;
+   passed &= testSameBucket();
+   passed &= testWidening();
+   passed &= testDueOrder();
+   passed &= testClosest();
+   return (passed ? 0 : 1);
+}
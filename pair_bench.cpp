@@ -0,0 +1,109 @@
+/******************************************************************************
+* Program:
+*    pair_bench - the cost of the Matchmaker's pair()
+* Summary:
+*    Players with random ratings come in one per simulated ms, and after
+*    each one pair() is called until it finds nobody more, the way the
+*    lobby calls it after every wakeup. Every call is timed, and the
+*    distribution of their cost is reported, with how many players were
+*    left waiting at most. The simulated clock lets the windows widen
+*    without the benchmark taking minutes.
+******************************************************************************/
+#include <algorithm> // sort
+#include <chrono>
+#include <cstdlib>  // atoi, rand, srand
+#include <iostream> // cout
+#include <unistd.h> // getopt
+#include <vector>
+
+#include "constants.h"
+#include "matchmaker.h"
+
+using namespace std;
+
+const int DEFAULT_ARRIVALS = 200000;
+const int RATING_SPREAD = 3000; // ratings from 0 to this
+
+// the Matchmaker's clock, moved by the benchmark, in ms
+static long long simulatedNow = 0;
+
+/******************************************************************************
+* simulatedClock() - what the benchmark set the time to
+******************************************************************************/
+static long long simulatedClock()
+{
+   return simulatedNow;
+}
+
+/******************************************************************************
+* MAIN
+* argv: [-n ARRIVALS] [-g MS_BETWEEN_ARRIVALS]
+******************************************************************************/
+int main(int argc, char** argv)
+{
+   int arrivals = DEFAULT_ARRIVALS;
+   int gap = 1;
+   int option;
+   while ((option = getopt(argc, argv, "n:g:")) != -1)
+   {
+      if (option == 'n')
+         arrivals = atoi(optarg);
+      else if (option == 'g')
+         gap = atoi(optarg);
+      else
+      {
+         cout << "Usage: " << argv[0]
+              << " [-n ARRIVALS] [-g MS_BETWEEN_ARRIVALS]\n";
+         return ERROR_BAD;
+      }
+   }
+
+   srand(1);
+   Matchmaker queue(simulatedClock);
+   vector<long long> costs; // ns per pair() call
+   costs.reserve(arrivals * 2);
+   size_t mostWaiting = 0;
+   long long pairs = 0;
+
+   for (int i = 0; i < arrivals; i++)
+   {
+      simulatedNow += gap;
+      Player* player = new Player;
+      player->rating = rand() % RATING_SPREAD;
+      queue.add(player);
+      mostWaiting = max(mostWaiting, queue.size());
+
+      bool found = true;
+      while (found)
+      {
+         Player* p1;
+         Player* p2;
+         chrono::steady_clock::time_point start = chrono::steady_clock::now();
+         found = queue.pair(p1, p2);
+         costs.push_back(chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count());
+         if (found)
+         {
+            pairs++;
+            delete p1;
+            delete p2;
+         }
+      }
+   }
+
+   sort(costs.begin(), costs.end());
+   long long total = 0;
+   for (size_t i = 0; i < costs.size(); i++)
+      total += costs[i];
+
+   cout << arrivals << " arrivals, " << pairs << " pairs, "
+        << mostWaiting << " waiting at most\n"
+        << "pair(): " << costs.size() << " calls, mean "
+        << total / (long long)costs.size() << " ns, p50 "
+        << costs[costs.size() / 2] << " ns, p99 "
+        << costs[costs.size() * 99 / 100] << " ns, max "
+        << costs.back() / 1000.0 << " us\n";
+
+   // what is left in the queue goes with the process
+   return 0;
+}
@@ -0,0 +1,18 @@
+#include <cstring>  // strncpy
+#include "player.h"
+#include "helpers.h" // now_ms
+
+/******************************************************************************
+* Player constructor - every member has a value, whoever builds the player:
+*                      the lobby for a client that just connected, the bot,
+*                      or a worker for a player handed over to it. A name
+*                      too long for a frame is cut.
+******************************************************************************/
+Player::Player(int clientFD, const char* name, bool isBot) :
+   isPlaying(false), isBot(isBot), clientFD(clientFD), idleSince(now_ms()),
+   rating(0), lobbyState(GREETING), namesAsked(0), askedShm(false),
+   wantsAny(true), deadline(0), lobbyEvents(0), greetingPos()
+{
+   strncpy(this->name, name, MAXLEN - 2);
+   this->name[MAXLEN - 2] = '\0';
+}
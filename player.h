@@ -0,0 +1,43 @@
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <list>
+#include "constants.h"
+#include "rtt.h"
+
+/******************************************************************************
+* where a connection is in its dialog with the lobby
+******************************************************************************/
+enum lobbyStates
+{
+   GREETING,    // asked for its name, not in the registry yet
+   IN_LOBBY,    // named, sends lobby commands
+   CHALLENGING  // sent CHAL, the name of the challenged player comes next
+};
+
+/******************************************************************************
+* the Player struct ~ a new one is not playing, and still GREETING
+******************************************************************************/
+struct Player
+{
+   Player(int clientFD = ERROR_BAD, const char* name = "", bool isBot = false);
+
+   bool isPlaying;    // flag indicating if that player is Playing a game
+   bool isBot;        // flag indicating if that player is the server's bot
+   int clientFD;      // client File Descriptor / Socket Descriptor
+   char name[MAXLEN]; // the name of the player
+   long long idleSince; // now_ms() of when the player started waiting
+   RttProbe rtt;        // round trip time to the player's client
+   double rating;       // the player's rating when it joined the lobby
+
+   // the lobby's side of the dialog
+   int lobbyState;      // see lobbyStates
+   int namesAsked;      // NAME prompts sent while GREETING
+   bool askedShm;       // it already asked for shared memory
+   bool wantsAny;       // it did not send LOBBY, so it is up for any game
+   long long deadline;  // now_ms() by which it must be done GREETING
+   short lobbyEvents;   // what the lobby's epoll set waits for on it
+   std::list<Player*>::iterator greetingPos; // in the lobby's greeting list
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include <cmath>  // pow
+#include "constants.h" // P1, P2, TIE
+#include "ratings.h"
+
+using namespace std;
+
+const int PROVISIONAL_GAMES = 20; // matches before a rating settles
+const double PROVISIONAL_K = 40;
+const double SETTLED_K = 16;
+
+/******************************************************************************
+* get() - the player's rating, DEFAULT_RATING if it never finished a match
+******************************************************************************/
+double Ratings::get(const char* name) const
+{
+   unordered_map<string, Rating>::const_iterator it = ratings.find(name);
+   return (it == ratings.end() ? DEFAULT_RATING : it->second.value);
+}
+
+/******************************************************************************
+* getGames() - how many of the player's matches were rated
+******************************************************************************/
+int Ratings::getGames(const char* name) const
+{
+   unordered_map<string, Rating>::const_iterator it = ratings.find(name);
+   return (it == ratings.end() ? 0 : it->second.games);
+}
+
+/******************************************************************************
+* update() - rates a match: each player moves by its K factor times the
+*            difference between its score (1 win, 0.5 tie, 0 loss) and the
+*            score its rating expected against the other one
+******************************************************************************/
+void Ratings::update(const char* p1, const char* p2, int result)
+{
+   Rating& r1 = find(p1);
+   Rating& r2 = find(p2);
+
+   double expected = 1 / (1 + pow(10, (r2.value - r1.value) / 400));
+   double score = (result == P1 ? 1 : (result == P2 ? 0 : 0.5));
+   double k1 = (r1.games < PROVISIONAL_GAMES ? PROVISIONAL_K : SETTLED_K);
+   double k2 = (r2.games < PROVISIONAL_GAMES ? PROVISIONAL_K : SETTLED_K);
+
+   r1.value += k1 * (score - expected);
+   r2.value += k2 * (expected - score);
+   r1.games++;
+   r2.games++;
+}
+
+/******************************************************************************
+* find() - the player's rating, created at DEFAULT_RATING if it has none
+******************************************************************************/
+Ratings::Rating& Ratings::find(const char* name)
+{
+   unordered_map<string, Rating>::iterator it = ratings.find(name);
+   if (it == ratings.end())
+   {
+      Rating rating = { DEFAULT_RATING, 0 };
+      it = ratings.insert(make_pair(string(name), rating)).first;
+   }
+   return it->second;
+}
@@ -0,0 +1,34 @@
+#ifndef RATINGS_H
+#define RATINGS_H
+
+#include <string>
+#include <unordered_map>
+
+/******************************************************************************
+* Ratings Class - the Elo rating of every player that finished a match, by
+*   name. Like Glicko, a rating moves fast while it is uncertain: the K
+*   factor is high for a player's first PROVISIONAL_GAMES matches, then
+*   settles. Unknown players start at DEFAULT_RATING.
+******************************************************************************/
+const double DEFAULT_RATING = 1500;
+
+class Ratings
+{
+   public:
+      double get(const char* name) const;
+      int getGames(const char* name) const;
+      void update(const char* p1, const char* p2, int result); // P1/P2/TIE
+
+   private:
+      struct Rating
+      {
+         double value;
+         int games; // matches rated so far
+      };
+
+      std::unordered_map<std::string, Rating> ratings;
+
+      Rating& find(const char* name);
+};
+
+#endif
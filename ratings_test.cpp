@@ -0,0 +1,80 @@
+#include <cmath>    // fabs, pow
+#include <cstdio>   // printf
+#include "constants.h" // P1, P2, TIE
+#include "ratings.h"
+
+// how far from the expected rating a computed one may land
+static const double EPSILON = 1e-9;
+
+/******************************************************************************
+* check() - reports a check of a case
+******************************************************************************/
+static bool check(const char* what, bool passed)
+{
+   printf("%-52s %s\n", what, passed ? "ok" : "FAILED");
+   return passed;
+}
+
+/******************************************************************************
+* near() - true if the rating is the expected one
+******************************************************************************/
+static bool near(double rating, double expected)
+{
+   return fabs(rating - expected) < EPSILON;
+}
+
+/******************************************************************************
+* main - the Elo update: provisional and settled K factors, the expected
+*        score, and that every rated match counts
+******************************************************************************/
+int main()
+{
+   bool passed = true;
+
+   Ratings ratings;
+   passed &= check("a new player starts at the default rating",
+                   near(ratings.get("new"), DEFAULT_RATING) &&
+                   ratings.getGames("new") == 0);
+
+   // even players: the winner takes K/2 from the loser
+   ratings.update("a", "b", P1);
+   passed &= check("even players, provisional: +20 / -20",
+                   near(ratings.get("a"), 1520) &&
+                   near(ratings.get("b"), 1480));
+   ratings.update("c", "d", P2);
+   passed &= check("the second player wins the same",
+                   near(ratings.get("c"), 1480) &&
+                   near(ratings.get("d"), 1520));
+   ratings.update("e", "f", TIE);
+   passed &= check("a tie between even players moves nobody",
+                   near(ratings.get("e"), 1500) &&
+                   near(ratings.get("f"), 1500) &&
+                   ratings.getGames("e") == 1 && ratings.getGames("f") == 1);
+
+   // 200 points apart, the favorite expects 1 / (1 + 10^(-200/400))
+   Ratings uneven;
+   uneven.update("x", "y", P1); // x 1520, y 1480
+   uneven.update("x", "y", P1); // x gains less: it was expected to win
+   double expected = 1 / (1 + pow(10, (1480.0 - 1520.0) / 400));
+   passed &= check("the favorite gains less than the underdog would",
+                   near(uneven.get("x"), 1520 + 40 * (1 - expected)) &&
+                   near(uneven.get("y"), 1480 - 40 * (1 - expected)));
+   Ratings upset;
+   upset.update("x", "y", P1);
+   upset.update("x", "y", P2);
+   passed &= check("the underdog gains more from an upset",
+                   near(upset.get("y"), 1480 + 40 * expected) &&
+                   near(upset.get("x"), 1520 - 40 * expected));
+
+   // after 20 rated matches, K drops from 40 to 16
+   Ratings settled;
+   for (int i = 0; i < 20; i++)
+      settled.update("old", "other", TIE);
+   settled.update("old", "new", P1);
+   passed &= check("a settled rating moves by 16, a new one by 40",
+                   near(settled.get("old"), 1508) &&
+                   near(settled.get("new"), 1480) &&
+                   settled.getGames("old") == 21);
+
+   return (passed ? 0 : 1);
+}
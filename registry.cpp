@@ -0,0 +1,157 @@
+#include <cstdio>  // snprintf
+#include <cstring> // strcpy
+#include "registry.h"
+
+using namespace std;
+
+/******************************************************************************
+* join() - registers a player that just got in the lobby. A name that is
+*          already taken (or the bot's) gets a "#2", "#3"... suffix, so that
+*          every player can be challenged by name.
+******************************************************************************/
+void Registry::join(Player* player, bool queued)
+{
+   if (!player->name[0])
+      strcpy(player->name, "Player");
+
+   // the bot's name is taken too, so nobody passes for the bot
+   string name = player->name;
+   for (int n = 2; entries.count(name) || name == BOT_NAME; n++)
+   {
+      char suffix[16];
+      int length = snprintf(suffix, sizeof(suffix), "#%d", n);
+      // cut to fit in a frame: the length byte counts the '\0' too
+      name = string(player->name).substr(0, MAXLEN - 2 - length) + suffix;
+   }
+   strcpy(player->name, name.c_str());
+
+   Entry& entry = entries[name];
+   entry.player = player;
+   entry.presence = WAITING;
+   entry.owner = 0;
+   entry.idlePos = idle.insert(idle.end(), player);
+   setQueued(player, queued);
+}
+
+/******************************************************************************
+* leave() - forgets a player that hung up while in the lobby
+******************************************************************************/
+void Registry::leave(Player* player)
+{
+   Entry* entry = getEntry(player->name);
+   if (!entry || entry->player != player)
+      return;
+
+   setQueued(player, false);
+   idle.erase(entry->idlePos);
+   entries.erase(player->name);
+}
+
+/******************************************************************************
+* setQueued() - moves a player in the lobby in or out of the queue for the
+*               next game with anybody
+******************************************************************************/
+void Registry::setQueued(Player* player, bool queued)
+{
+   Entry* entry = getEntry(player->name);
+   if (!entry || entry->player != player || entry->presence == PLAYING)
+      return;
+
+   if (queued && entry->presence == WAITING)
+   {
+      queue.add(player);
+      entry->presence = QUEUED;
+   }
+   else if (!queued && entry->presence == QUEUED)
+   {
+      queue.remove(player);
+      entry->presence = WAITING;
+   }
+}
+
+/******************************************************************************
+* startGame() - the player leaves the lobby for a game run by the owner
+*               process. The registry lets go of the Player*, and keeps the
+*               name until the game is over.
+******************************************************************************/
+void Registry::startGame(Player* player, int owner)
+{
+   Entry* entry = getEntry(player->name);
+   if (!entry || entry->player != player)
+      return;
+
+   if (entry->presence == QUEUED)
+      queue.remove(player, true); // the wait counts: it got a game
+   idle.erase(entry->idlePos);
+   entry->player = NULL;
+   entry->presence = PLAYING;
+   entry->owner = owner;
+
+   // the key of the entry is the interned name
+   games[owner].insert(&entries.find(player->name)->first);
+}
+
+/******************************************************************************
+* endGame() - the game of that player, run by owner, is over
+******************************************************************************/
+void Registry::endGame(const char* name, int owner)
+{
+   unordered_map<string, Entry>::iterator it = entries.find(name);
+   if (it == entries.end() || it->second.presence != PLAYING ||
+       it->second.owner != owner)
+      return;
+
+   unordered_map<int, Names>::iterator game = games.find(owner);
+   if (game != games.end())
+   {
+      game->second.erase(&it->first);
+      if (game->second.empty())
+         games.erase(game);
+   }
+   entries.erase(it);
+}
+
+/******************************************************************************
+* endGames() - every game run by owner is over (it exited, or died)
+******************************************************************************/
+void Registry::endGames(int owner)
+{
+   unordered_map<int, Names>::iterator game = games.find(owner);
+   if (game == games.end())
+      return;
+
+   for (Names::iterator name = game->second.begin();
+        name != game->second.end(); ++name)
+   {
+      string key = **name; // not a reference into the entry being erased
+      entries.erase(key);
+   }
+   games.erase(game);
+}
+
+/******************************************************************************
+* getPresence() - where the player by that name is, OFFLINE if nobody
+******************************************************************************/
+int Registry::getPresence(const char* name) const
+{
+   unordered_map<string, Entry>::const_iterator it = entries.find(name);
+   return (it == entries.end() ? OFFLINE : it->second.presence);
+}
+
+/******************************************************************************
+* findIdle() - the player by that name, if it is in the lobby
+******************************************************************************/
+Player* Registry::findIdle(const char* name) const
+{
+   unordered_map<string, Entry>::const_iterator it = entries.find(name);
+   return (it == entries.end() ? NULL : it->second.player);
+}
+
+/******************************************************************************
+* getEntry() - the entry of the player by that name, NULL if none
+******************************************************************************/
+Registry::Entry* Registry::getEntry(const char* name)
+{
+   unordered_map<string, Entry>::iterator it = entries.find(name);
+   return (it == entries.end() ? NULL : &it->second);
+}
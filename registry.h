@@ -0,0 +1,62 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "matchmaker.h"
+#include "player.h"
+
+/******************************************************************************
+* Registry Class - the lobby's index of the players online, by name: the ones
+*   in the lobby, and the humans in a game in any process. Names are interned:
+*   the key of a player's entry is the only copy the registry keeps, and the
+*   games refer to their players through it. Joining, leaving, lookups and
+*   presence changes are a hash lookup each, the players in the lobby are
+*   also kept in arrival order, and the queued ones in the matchmaker's
+*   rating buckets, so pairing or listing them never walks the whole
+*   registry.
+*   Only the lobby touches it, from its single thread: no locks needed.
+******************************************************************************/
+enum presences
+{
+   OFFLINE, // nobody by that name
+   WAITING, // in the lobby, waiting to be challenged (or deciding)
+   QUEUED,  // in the lobby, up for the next game with anybody
+   PLAYING  // in a game
+};
+
+class Registry
+{
+   public:
+      void join(Player* player, bool queued); // renames the player if taken
+      void leave(Player* player);             // hung up in the lobby
+      void setQueued(Player* player, bool queued);
+      void startGame(Player* player, int owner); // owner: pid of the game
+      void endGame(const char* name, int owner);
+      void endGames(int owner); // the owner process is gone
+      int getPresence(const char* name) const;
+      Player* findIdle(const char* name) const; // NULL unless in the lobby
+      const std::list<Player*>& getIdle() const { return idle; }
+      Matchmaker& getQueue() { return queue; }
+
+   private:
+      struct Entry
+      {
+         Player* player; // NULL once the player is in a game
+         int presence;
+         int owner;      // pid of the process running the player's game
+         std::list<Player*>::iterator idlePos; // valid unless PLAYING
+      };
+      typedef std::unordered_set<const std::string*> Names; // interned
+
+      std::unordered_map<std::string, Entry> entries;
+      std::list<Player*> idle; // in the lobby, oldest first
+      Matchmaker queue;        // the QUEUED ones
+      std::unordered_map<int, Names> games; // owner pid -> its players
+
+      Entry* getEntry(const char* name);
+};
+
+#endif
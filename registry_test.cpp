@@ -0,0 +1,188 @@
+#include <algorithm> // find
+#include <cstdio>   // printf
+#include <cstring>  // strcpy, strlen
+#include <string>
+#include <vector>
+#include "constants.h" // MAXLEN, BOT_NAME
+#include "registry.h"
+
+using namespace std;
+
+/******************************************************************************
+* check() - reports a check of a case
+******************************************************************************/
+static bool check(const char* what, bool passed)
+{
+   printf("%-52s %s\n", what, passed ? "ok" : "FAILED");
+   return passed;
+}
+
+/******************************************************************************
+* namedPlayer() - a player that gave that name
+******************************************************************************/
+static Player* namedPlayer(const string& name)
+{
+   Player* player = new Player;
+   strcpy(player->name, name.c_str());
+   player->rating = 1500;
+   return player;
+}
+
+/******************************************************************************
+* isIdle() - true if the player is in the lobby's arrival list
+******************************************************************************/
+static bool isIdle(Registry& registry, Player* player)
+{
+   const list<Player*>& idle = registry.getIdle();
+   return find(idle.begin(), idle.end(), player) != idle.end();
+}
+
+/******************************************************************************
+* testRename() - a name that is taken gets the next free suffix, and so does
+*                the bot's. A suffix never makes the name too long for a
+*                frame.
+******************************************************************************/
+static bool testRename()
+{
+   Registry registry;
+   vector<Player*> players;
+   const char* names[] = { "a", "a", "a", BOT_NAME, "" };
+   for (int i = 0; i < 5; i++)
+   {
+      players.push_back(namedPlayer(names[i]));
+      registry.join(players.back(), false);
+   }
+
+   bool passed = check("rename: the first one keeps its name",
+                       strcmp(players[0]->name, "a") == 0);
+   passed &= check("rename: the next ones get #2, #3",
+                   strcmp(players[1]->name, "a#2") == 0 &&
+                   strcmp(players[2]->name, "a#3") == 0);
+   passed &= check("rename: nobody gets the bot's name",
+                   strcmp(players[3]->name, (string(BOT_NAME) + "#2").c_str())
+                   == 0);
+   passed &= check("rename: no name is a name too",
+                   strcmp(players[4]->name, "Player") == 0);
+
+   string longest(MAXLEN - 2, 'x'); // the longest a frame carries
+   players.push_back(namedPlayer(longest));
+   players.push_back(namedPlayer(longest));
+   registry.join(players[5], false);
+   registry.join(players[6], false);
+   string renamed = players[6]->name;
+   passed &= check("rename: a long name is cut to make room",
+                   renamed.size() == longest.size() &&
+                   renamed.compare(renamed.size() - 2, 2, "#2") == 0);
+
+   bool found = true;
+   for (size_t i = 0; i < players.size(); i++)
+      found &= (registry.findIdle(players[i]->name) == players[i]);
+   passed &= check("rename: each is found by the name it got", found);
+
+   for (size_t i = 0; i < players.size(); i++)
+   {
+      registry.leave(players[i]);
+      delete players[i];
+   }
+   return passed;
+}
+
+/******************************************************************************
+* testPresence() - a player's way through the lobby: waiting, queued,
+*                  playing, then gone once its game is over. Only the game's
+*                  owner can end it.
+******************************************************************************/
+static bool testPresence()
+{
+   Registry registry;
+   Player* player = namedPlayer("p");
+   registry.join(player, false);
+   bool passed = check("presence: joined and waiting",
+                       registry.getPresence("p") == WAITING &&
+                       registry.findIdle("p") == player &&
+                       isIdle(registry, player) &&
+                       registry.getQueue().size() == 0);
+
+   registry.setQueued(player, true);
+   passed &= check("presence: queued for any game",
+                   registry.getPresence("p") == QUEUED &&
+                   registry.getQueue().size() == 1);
+   registry.setQueued(player, false);
+   passed &= check("presence: back to waiting",
+                   registry.getPresence("p") == WAITING &&
+                   registry.getQueue().size() == 0);
+
+   registry.setQueued(player, true);
+   registry.startGame(player, 42);
+   passed &= check("presence: playing, out of the lobby",
+                   registry.getPresence("p") == PLAYING &&
+                   !registry.findIdle("p") && !isIdle(registry, player) &&
+                   registry.getQueue().size() == 0);
+
+   // the name stays taken for as long as the game runs
+   Player* other = namedPlayer("p");
+   registry.join(other, false);
+   passed &= check("presence: a playing name is still taken",
+                   strcmp(other->name, "p#2") == 0);
+   registry.leave(other);
+   delete other;
+
+   registry.endGame("p", 41);
+   passed &= check("presence: another process can't end the game",
+                   registry.getPresence("p") == PLAYING);
+   registry.endGame("p", 42);
+   passed &= check("presence: offline once the game is over",
+                   registry.getPresence("p") == OFFLINE);
+   delete player; // the game's process owned it
+
+   Player* again = namedPlayer("p");
+   registry.join(again, true);
+   passed &= check("presence: the name is free again",
+                   strcmp(again->name, "p") == 0 &&
+                   registry.getPresence("p") == QUEUED);
+   registry.leave(again);
+   passed &= check("presence: offline after leaving the lobby",
+                   registry.getPresence("p") == OFFLINE &&
+                   registry.getQueue().size() == 0 &&
+                   registry.getIdle().empty());
+   delete again;
+   return passed;
+}
+
+/******************************************************************************
+* testEndGames() - a process that exits (or dies) ends all its games, and
+*                  nobody else's
+******************************************************************************/
+static bool testEndGames()
+{
+   Registry registry;
+   const char* names[] = { "w1", "w2", "x1" };
+   Player* players[3];
+   for (int i = 0; i < 3; i++)
+   {
+      players[i] = namedPlayer(names[i]);
+      registry.join(players[i], true);
+      registry.startGame(players[i], i < 2 ? 7 : 8);
+      delete players[i];
+   }
+
+   registry.endGames(7);
+   bool passed = check("end games: the process's players are offline",
+                       registry.getPresence("w1") == OFFLINE &&
+                       registry.getPresence("w2") == OFFLINE);
+   passed &= check("end games: the other process's still play",
+                   registry.getPresence("x1") == PLAYING);
+   return passed;
+}
+
+/******************************************************************************
+* main - the registry's names and presences
+******************************************************************************/
+int main()
+{
+   bool passed = true;
+   passed &= testRename();
+   passed &= testPresence();
+   passed &= testEndGames();
+   return (passed ? 0 : 1);
+}
@@ -0,0 +1,756 @@
+/******************************************************************************
+* Program:
+*    replay - replays a capture of the server's traffic against a server
+* Summary:
+*    Reads a capture written by the server (server -t CAPTURE_FILE), and
+*    plays every captured client again, all of them from this one process:
+*    each connection opens when it did in the capture, and sends what its
+*    client sent. A frame is only sent once the server sent what it had sent
+*    before it in the capture, then after the same think time as the
+*    client's. -s scales the times: 1 (default) replays at the captured
+*    pace, 10 ten times faster, and max sends everything as soon as the
+*    server allows it. -c replays each connection that many times at once;
+*    the copies give their name (and the name of whom they challenge) with
+*    a "~1", "~2"... suffix, so that they play each other like the captured
+*    clients did. The server's PINGs are answered here, like a client would.
+*
+*    At the end, it reports the latency of each frame the server sent
+*    (since the client's last frame), in the capture and in the replay: per
+*    command, per tenth of the capture, and the frames that diverged most.
+*    The captured latencies were taken on the server, the replayed ones on
+*    this side of the socket. The connections the server turned away (BUSY)
+*    are counted apart, they are not mismatches.
+******************************************************************************/
+#include <algorithm> // sort, stable_sort
+#include <cerrno>    // errno
+#include <cstdlib>   // atoi, atof
+#include <cstring>   // memset, memcpy, strcmp
+#include <fcntl.h>   // fcntl
+#include <iomanip>   // setprecision
+#include <iostream>  // cout
+#include <map>
+#include <netdb.h>   // getaddrinfo
+#include <netinet/in.h>  // IPPROTO_TCP
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <poll.h>    // poll
+#include <sys/resource.h> // setrlimit
+#include <sys/socket.h>   // socket, connect, send, recv
+#include <sys/un.h>  // sockaddr_un
+#include <unistd.h>  // close, getopt
+#include <vector>
+
+#include "capture.h"
+#include "constants.h"
+#include "helpers.h"
+
+using namespace std;
+
+const long long STALL_TIMEOUT = 2000000; // us waited on top of the capture's
+const int DIVERGENCES = 10; // frames reported among the most diverging
+const int SLICES = 10;      // of the capture, for the timeline
+const size_t MAX_FRAME = 254; // characters in a frame, its length is a byte
+
+/******************************************************************************
+* what a captured client did, and what the server sent it
+******************************************************************************/
+struct Step
+{
+   int type;          // CAPTURE_IN (send the frame) or CAPTURE_CLOSE
+   string frame;
+   size_t after;      // frames the server had sent before it
+   long long gap;     // us since the connection's previous frame
+   long long patience; // us the server took to send those, in the capture
+   bool naming;       // the frame is a name: a copy adds its suffix
+};
+
+struct Expected
+{
+   string command;    // see getCommand()
+   long long at;      // us since the capture started
+   long long latency; // us since the client's last frame (or its connect)
+};
+
+struct Script
+{
+   int conn;
+   long long openAt; // us since the capture started
+   vector<Step> steps;
+   vector<Expected> expected;
+};
+
+/******************************************************************************
+* a captured connection being replayed
+******************************************************************************/
+struct Replayed
+{
+   const Script* script;
+   int copy;             // 0 for the first copy of the script
+   int fd;
+   size_t address;       // of the server's, the one being tried
+   bool connecting;      // until the socket is writable
+   size_t next;          // steps[next] is the next thing to do
+   size_t received;      // frames received, but PINGs
+   long long lastAt;     // now_us() of its last frame, either way
+   long long lastSentAt; // now_us() of its last frame sent (or connect)
+   long long dueAt;      // when steps[next] is sent, -1 until it can be
+   string in;            // received, not a whole frame yet
+   string out;           // to send, the socket was full
+   bool done;
+};
+
+/******************************************************************************
+* a frame whose latency is compared
+******************************************************************************/
+struct Sample
+{
+   string command;
+   int conn;
+   size_t index; // among the frames the server sent on the connection
+   long long at;
+   long long captured;
+   long long replayed;
+};
+
+static double speed = 1; // 0 = as fast as the server goes
+static long long sent = 0;
+static long long stalls = 0;     // steps sent without the server's frames
+static long long mismatched = 0; // not the command the capture had there
+static long long extra = 0;      // frames past the end of the capture's
+static long long failed = 0;     // connections that could not connect
+static long long busy = 0;       // connections the server turned away
+static vector<Sample> samples;
+static vector<struct sockaddr_storage> addresses; // of the server, resolved
+static vector<socklen_t> addressSizes;            // once for all
+static size_t working = 0; // the address the last connection got through
+
+/******************************************************************************
+* getCommand() - what a frame is, for comparing: the command itself, or
+*                "(move)" / "(text)" for the moves, names and messages
+******************************************************************************/
+static string getCommand(const string& frame)
+{
+   if (frame.size() == 1 && strchr("rpsq", frame[0]))
+      return "(move)";
+   for (size_t i = 0; i < frame.size(); i++)
+   {
+      if (frame[i] < 'A' || frame[i] > 'Z')
+         return "(text)";
+   }
+   return (frame.empty() ? "(text)" : frame);
+}
+
+/******************************************************************************
+* buildScripts() - turns the records of the capture into one script per
+*                  connection. The server's PINGs and the clients' PONGs are
+*                  left out: the replay answers the PINGs of the server it
+*                  plays against. Without shared memory (noShm), a request
+*                  for it is left out too, along with the name prompt the
+*                  server sent again after it. The client's name, and the
+*                  name following a CHAL, are marked as names.
+******************************************************************************/
+static void buildScripts(vector<CaptureRecord>& records,
+                         vector<Script>& scripts, bool noShm)
+{
+   // every process appends in its own time: back in time order
+   stable_sort(records.begin(), records.end(),
+               [](const CaptureRecord& a, const CaptureRecord& b)
+               { return a.time < b.time; });
+
+   long long start = (records.empty() ? 0 : records.front().time);
+   map<int, size_t> byConn;
+   map<int, long long> lastAt;   // of any frame of the connection
+   map<int, long long> lastInAt; // of the client's last frame (or open)
+   map<int, long long> lastOutAt;
+   map<int, bool> skipOut;
+   map<int, bool> closed;
+   map<int, int> prompts; // NAMEs the server sent
+   map<int, bool> named;
+   map<int, bool> challenging;
+
+   for (size_t i = 0; i < records.size(); i++)
+   {
+      const CaptureRecord& record = records[i];
+      int conn = record.conn;
+      if (!conn || closed[conn])
+         continue;
+
+      if (!byConn.count(conn))
+      {
+         byConn[conn] = scripts.size();
+         scripts.push_back(Script());
+         scripts.back().conn = conn;
+         scripts.back().openAt = record.time - start;
+         lastAt[conn] = lastInAt[conn] = lastOutAt[conn] = record.time;
+      }
+      Script& script = scripts[byConn[conn]];
+
+      if (record.type == CAPTURE_OUT)
+      {
+         if (record.frame == PING)
+            continue;
+         if (record.frame == GET_NAME)
+            prompts[conn]++;
+         if (skipOut[conn])
+         {
+            skipOut[conn] = false;
+            continue;
+         }
+         Expected expected = { getCommand(record.frame), record.time - start,
+                               record.time - lastInAt[conn] };
+         script.expected.push_back(expected);
+         lastAt[conn] = lastOutAt[conn] = record.time;
+      }
+      else if (record.type == CAPTURE_IN || record.type == CAPTURE_CLOSE)
+      {
+         if (record.frame == PONG)
+            continue;
+         if (noShm && record.frame == SHM)
+         {
+            skipOut[conn] = true;
+            continue;
+         }
+
+         Step step;
+         step.type = record.type;
+         step.frame = record.frame;
+         step.after = script.expected.size();
+         step.gap = record.time - lastAt[conn];
+         step.patience = max(0LL, lastOutAt[conn] - lastInAt[conn]);
+         // SHM or LOBBY may answer the first 2 prompts, not the third
+         step.naming = challenging[conn];
+         if (!named[conn] && !script.expected.empty() &&
+             script.expected.back().command == GET_NAME &&
+             ((record.frame != SHM && record.frame != LOBBY) ||
+              prompts[conn] >= 3))
+            step.naming = named[conn] = true;
+         challenging[conn] = (named[conn] && record.frame == CHALLENGE);
+         script.steps.push_back(step);
+         lastAt[conn] = lastInAt[conn] = record.time;
+         closed[conn] = (record.type == CAPTURE_CLOSE);
+      }
+   }
+}
+
+/******************************************************************************
+* resolve() - the addresses of the server, looked up once for all the
+*             connections. ERROR_BAD if there are none.
+******************************************************************************/
+static int resolve(const char* host, int port, const char* path)
+{
+   struct sockaddr_storage address;
+   memset(&address, 0, sizeof(address));
+   if (path)
+   {
+      struct sockaddr_un* local = (struct sockaddr_un*)&address;
+      local->sun_family = AF_UNIX;
+      strncpy(local->sun_path, path, sizeof(local->sun_path) - 1);
+      addresses.push_back(address);
+      addressSizes.push_back(sizeof(struct sockaddr_un));
+      return ERROR_OK;
+   }
+
+   struct addrinfo hints;
+   struct addrinfo* found = NULL;
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   int error = getaddrinfo(host, to_string(port).c_str(), &hints, &found);
+   if (error != ERROR_OK)
+   {
+      cout << "can't resolve " << host << ": " << gai_strerror(error) << "\n";
+      return ERROR_BAD;
+   }
+   for (struct addrinfo* it = found; it; it = it->ai_next)
+   {
+      memcpy(&address, it->ai_addr, it->ai_addrlen);
+      addresses.push_back(address);
+      addressSizes.push_back(it->ai_addrlen);
+   }
+   freeaddrinfo(found);
+   return (addresses.empty() ? ERROR_BAD : ERROR_OK);
+}
+
+/******************************************************************************
+* connectTo() - starts a non blocking connection to the server, from the
+*               address the last one got through: it is done once the
+*               socket is writable (see onConnected()). ERROR_BAD if no
+*               address could even be tried.
+******************************************************************************/
+static int connectTo(Replayed& replayed)
+{
+   for (; replayed.address < addresses.size(); replayed.address++)
+   {
+      const struct sockaddr_storage& address = addresses[replayed.address];
+      replayed.fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if (replayed.fd == ERROR_BAD)
+         continue;
+      if (connect(replayed.fd, (const struct sockaddr*)&address,
+                  addressSizes[replayed.address]) == ERROR_OK ||
+          errno == EINPROGRESS)
+      {
+         replayed.connecting = true;
+         return ERROR_OK;
+      }
+      close(replayed.fd);
+   }
+   replayed.fd = ERROR_BAD;
+   return ERROR_BAD;
+}
+
+/******************************************************************************
+* hangUp() - the replayed connection is over
+******************************************************************************/
+static void hangUp(Replayed& replayed)
+{
+   if (replayed.fd != ERROR_BAD)
+      close(replayed.fd);
+   replayed.fd = ERROR_BAD;
+   replayed.done = true;
+}
+
+/******************************************************************************
+* onConnected() - the connection is writable: connected, or refused. Then
+*                 the next address is tried, if the server has more.
+******************************************************************************/
+static void onConnected(Replayed& replayed, long long now)
+{
+   int error = 0;
+   socklen_t size = sizeof(error);
+   if (getsockopt(replayed.fd, SOL_SOCKET, SO_ERROR, &error, &size) < 0)
+      error = errno;
+   if (error)
+   {
+      close(replayed.fd);
+      replayed.address++;
+      if (connectTo(replayed) == ERROR_BAD)
+      {
+         failed++;
+         hangUp(replayed);
+      }
+      return;
+   }
+
+   replayed.connecting = false;
+   working = replayed.address;
+   int on = 1;
+   if (addresses[working].ss_family != AF_UNIX)
+      setsockopt(replayed.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+   replayed.lastAt = replayed.lastSentAt = now;
+}
+
+/******************************************************************************
+* flushOut() - sends what the connection has queued, as much as fits
+******************************************************************************/
+static void flushOut(Replayed& replayed)
+{
+   while (!replayed.out.empty())
+   {
+      ssize_t count = send(replayed.fd, replayed.out.data(),
+                           replayed.out.size(), MSG_NOSIGNAL);
+      if (count > 0)
+         replayed.out.erase(0, count);
+      else
+      {
+         if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+             errno != EINTR)
+            hangUp(replayed);
+         return;
+      }
+   }
+}
+
+/******************************************************************************
+* sendFrame() - queues a frame to the server, and sends it if it can
+******************************************************************************/
+static void sendFrame(Replayed& replayed, const string& message)
+{
+   replayed.out += (char)(message.size() + 1);
+   replayed.out += message;
+   replayed.out += '\0';
+   flushOut(replayed);
+}
+
+/******************************************************************************
+* advance() - does the connection's next steps, as far as the server's
+*             frames and the think times allow
+******************************************************************************/
+static void advance(Replayed& replayed, long long now)
+{
+   const Script& script = *replayed.script;
+   while (!replayed.done && replayed.next < script.steps.size())
+   {
+      const Step& step = script.steps[replayed.next];
+      if (replayed.dueAt < 0)
+      {
+         if (replayed.received < step.after)
+         {
+            // the server is behind the capture, or sent something else
+            if (now - replayed.lastSentAt < step.patience + STALL_TIMEOUT)
+               return;
+            stalls++;
+         }
+         replayed.dueAt = replayed.lastAt +
+                          (speed > 0 ? (long long)(step.gap / speed) : 0);
+      }
+      if (now < replayed.dueAt)
+         return;
+
+      if (step.type == CAPTURE_CLOSE)
+      {
+         hangUp(replayed);
+         return;
+      }
+      if (step.naming && replayed.copy)
+      {
+         // the copies must not take each other's name
+         string suffix = "~" + to_string(replayed.copy);
+         sendFrame(replayed, step.frame.substr(0, MAX_FRAME - suffix.size()) +
+                             suffix);
+      }
+      else
+         sendFrame(replayed, step.frame);
+      sent++;
+      replayed.lastAt = replayed.lastSentAt = now;
+      replayed.dueAt = -1;
+      replayed.next++;
+   }
+
+   // the script is over: hang up once the server is done too
+   if (!replayed.done && (replayed.received >= script.expected.size() ||
+                          now - replayed.lastAt > STALL_TIMEOUT))
+      hangUp(replayed);
+}
+
+/******************************************************************************
+* onFrame() - a frame from the server: compare its latency to the capture's
+******************************************************************************/
+static void onFrame(Replayed& replayed, const string& frame, long long now)
+{
+   if (frame == PING)
+   {
+      sendFrame(replayed, PONG);
+      return;
+   }
+   if (frame == SHM || frame == NO_SHM)
+      return; // the answer to a request for shared memory, not a frame
+
+   const Script& script = *replayed.script;
+   size_t index = replayed.received;
+   bool expected = (index < script.expected.size());
+   if (frame == SERVER_BUSY)
+   {
+      // turned away: only a mismatch if the capture was not
+      busy++;
+      if (!expected || script.expected[index].command != SERVER_BUSY)
+         return;
+   }
+
+   replayed.received++;
+   replayed.lastAt = now;
+   if (!expected)
+   {
+      extra++;
+      return;
+   }
+
+   const Expected& captured = script.expected[index];
+   if (getCommand(frame) != captured.command)
+      mismatched++;
+
+   Sample sample = { captured.command, script.conn, index, captured.at,
+                     captured.latency, now - replayed.lastSentAt };
+   samples.push_back(sample);
+}
+
+/******************************************************************************
+* onReadable() - takes the whole frames the server sent
+******************************************************************************/
+static void onReadable(Replayed& replayed, long long now)
+{
+   char buffer[4096];
+   ssize_t count;
+   while ((count = recv(replayed.fd, buffer, sizeof(buffer), 0)) > 0)
+      replayed.in.append(buffer, count);
+   bool gone = (count == 0 ||
+                (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR));
+
+   size_t at = 0;
+   while (at < replayed.in.size() &&
+          at + 1 + (unsigned char)replayed.in[at] <= replayed.in.size())
+   {
+      int length = (unsigned char)replayed.in[at];
+      string frame = replayed.in.substr(at + 1, length);
+      frame = frame.substr(0, frame.find('\0'));
+      at += 1 + length;
+      onFrame(replayed, frame, now);
+      advance(replayed, now);
+      if (replayed.done)
+         return;
+   }
+   replayed.in.erase(0, at);
+
+   if (gone)
+      hangUp(replayed);
+}
+
+/******************************************************************************
+* percentile() - of the values, in ms
+******************************************************************************/
+static double percentile(vector<long long> values, int p)
+{
+   if (values.empty())
+      return 0;
+   sort(values.begin(), values.end());
+   return values[(values.size() - 1) * p / 100] / 1000.0;
+}
+
+/******************************************************************************
+* report() - the latencies of the replay against the capture's
+******************************************************************************/
+static void report(long long duration)
+{
+   cout << fixed << setprecision(2);
+
+   // per command
+   map<string, vector<long long> > captured;
+   map<string, vector<long long> > replayed;
+   for (size_t i = 0; i < samples.size(); i++)
+   {
+      captured[samples[i].command].push_back(samples[i].captured);
+      replayed[samples[i].command].push_back(samples[i].replayed);
+   }
+   cout << "\nlatency (ms)        frames   captured p50 / p99   "
+        << "replayed p50 / p99\n";
+   for (map<string, vector<long long> >::iterator it = captured.begin();
+        it != captured.end(); ++it)
+   {
+      cout << "  " << setw(16) << left << it->first << right << setw(9)
+           << it->second.size() << setw(15) << percentile(it->second, 50)
+           << " / " << setw(6) << percentile(it->second, 99)
+           << setw(15) << percentile(replayed[it->first], 50) << " / "
+           << setw(6) << percentile(replayed[it->first], 99) << "\n";
+   }
+
+   // per tenth of the capture, to see where in the load it diverges
+   vector<vector<long long> > slicesCaptured(SLICES);
+   vector<vector<long long> > slicesReplayed(SLICES);
+   for (size_t i = 0; i < samples.size(); i++)
+   {
+      int slice = (duration ? (int)(samples[i].at * SLICES / (duration + 1))
+                            : 0);
+      slicesCaptured[slice].push_back(samples[i].captured);
+      slicesReplayed[slice].push_back(samples[i].replayed);
+   }
+   cout << "\ncapture time (s)    frames   captured p50 / p99   "
+        << "replayed p50 / p99\n";
+   for (int i = 0; i < SLICES; i++)
+   {
+      if (slicesCaptured[i].empty())
+         continue;
+      cout << "  " << setw(6) << duration * i / SLICES / 1e6 << " - "
+           << setw(6) << left << duration * (i + 1) / SLICES / 1e6 << right
+           << setw(10) << slicesCaptured[i].size()
+           << setw(15) << percentile(slicesCaptured[i], 50) << " / "
+           << setw(6) << percentile(slicesCaptured[i], 99)
+           << setw(15) << percentile(slicesReplayed[i], 50) << " / "
+           << setw(6) << percentile(slicesReplayed[i], 99) << "\n";
+   }
+
+   // the frames that took the longest compared to the capture
+   vector<Sample> worst(samples);
+   sort(worst.begin(), worst.end(), [](const Sample& a, const Sample& b)
+        { return a.replayed - a.captured > b.replayed - b.captured; });
+   if (worst.size() > (size_t)DIVERGENCES)
+      worst.resize(DIVERGENCES);
+   cout << "\nmost diverging frames:\n";
+   for (size_t i = 0; i < worst.size(); i++)
+   {
+      cout << "  " << showpos << setw(9)
+           << (worst[i].replayed - worst[i].captured) / 1000.0 << noshowpos
+           << " ms  conn " << worst[i].conn << " frame " << worst[i].index
+           << " " << worst[i].command << " at " << worst[i].at / 1e6
+           << " s: " << worst[i].captured / 1000.0 << " ms captured, "
+           << worst[i].replayed / 1000.0 << " ms replayed\n";
+   }
+}
+
+/******************************************************************************
+* MAIN
+* argv: [-s speed|max] [-c copies] [-u socket_path] capture_file [host] [port]
+******************************************************************************/
+int main(int argc, char** argv)
+{
+   int copies = 1;
+   const char* path = NULL;
+   const char* host = "127.0.0.1";
+   int port = DEFAULT_PORT;
+   int option;
+
+   while ((option = getopt(argc, argv, "s:c:u:")) != -1)
+   {
+      if (option == 's')
+         speed = (strcmp(optarg, "max") == 0 ? 0 : atof(optarg));
+      else if (option == 'c')
+         copies = atoi(optarg);
+      else if (option == 'u')
+         path = optarg;
+      else
+         optind = argc + 1; // the usage below
+   }
+   if (optind >= argc || optind + 3 < argc || copies < 1 || speed < 0)
+   {
+      cout << "Usage: " << argv[0] << " [-s SPEED|max] [-c COPIES]"
+           << " [-u SOCKET_PATH] CAPTURE_FILE [HOST] [PORT]\n";
+      return ERROR_BAD;
+   }
+   if (optind + 1 < argc)
+      host = argv[optind + 1];
+   if (optind + 2 < argc)
+      port = atoi(argv[optind + 2]);
+
+   vector<CaptureRecord> records;
+   if (capture_load(argv[optind], records) == ERROR_BAD)
+      exitErr("Failed to read the capture");
+   vector<Script> scripts;
+   buildScripts(records, scripts, path != NULL);
+   if (resolve(host, port, path) == ERROR_BAD)
+      return ERROR_BAD;
+   long long duration = (records.empty() ? 0 :
+                         records.back().time - records.front().time);
+
+   // every replayed connection is an open fd
+   struct rlimit limit;
+   if (getrlimit(RLIMIT_NOFILE, &limit) == ERROR_OK)
+   {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
+   }
+
+   // in the order they connect
+   vector<Replayed> connections;
+   for (size_t i = 0; i < scripts.size(); i++)
+   {
+      for (int j = 0; j < copies; j++)
+      {
+         Replayed replayed;
+         replayed.script = &scripts[i];
+         replayed.copy = j;
+         replayed.fd = ERROR_BAD;
+         replayed.address = 0;
+         replayed.connecting = false;
+         replayed.next = replayed.received = 0;
+         replayed.lastAt = replayed.lastSentAt = 0;
+         replayed.dueAt = -1;
+         replayed.done = false;
+         connections.push_back(replayed);
+      }
+   }
+   stable_sort(connections.begin(), connections.end(),
+               [](const Replayed& a, const Replayed& b)
+               { return a.script->openAt < b.script->openAt; });
+
+   long long start = now_us();
+   size_t opened = 0;
+   size_t active = 0;
+   while (opened < connections.size() || active)
+   {
+      long long now = now_us();
+      while (opened < connections.size() &&
+             (speed == 0 || start + (long long)(
+                 connections[opened].script->openAt / speed) <= now))
+      {
+         Replayed& replayed = connections[opened++];
+         replayed.address = working;
+         replayed.lastAt = replayed.lastSentAt = now_us();
+         if (connectTo(replayed) == ERROR_BAD)
+         {
+            failed++;
+            replayed.done = true;
+         }
+         else
+            active++;
+      }
+
+      // do what is due, and sleep until the next thing is
+      vector<struct pollfd> fds;
+      vector<Replayed*> owners;
+      long long wakeAt = now + 100000; // notice the stalls
+      if (opened < connections.size() && speed > 0)
+         wakeAt = min(wakeAt, start + (long long)(
+                      connections[opened].script->openAt / speed));
+      for (size_t i = 0; i < opened; i++)
+      {
+         Replayed& replayed = connections[i];
+         if (replayed.done)
+            continue;
+         if (!replayed.connecting)
+            advance(replayed, now);
+         if (replayed.done)
+         {
+            active--;
+            continue;
+         }
+         if (replayed.dueAt >= 0)
+            wakeAt = min(wakeAt, replayed.dueAt);
+
+         struct pollfd pfd;
+         pfd.fd = replayed.fd;
+         if (replayed.connecting)
+            pfd.events = POLLOUT;
+         else
+            pfd.events = POLLIN | (replayed.out.empty() ? 0 : POLLOUT);
+         pfd.revents = 0;
+         fds.push_back(pfd);
+         owners.push_back(&replayed);
+      }
+
+      long long wait = wakeAt - now_us();
+      int timeout = (wait > 0 ? (int)((wait + 999) / 1000) : 0);
+      if (poll(fds.empty() ? NULL : &fds[0], fds.size(), timeout) < 0)
+         continue; // EINTR
+
+      now = now_us();
+      for (size_t i = 0; i < fds.size(); i++)
+      {
+         Replayed& replayed = *owners[i];
+         if (replayed.connecting)
+         {
+            if (fds[i].revents)
+               onConnected(replayed, now);
+            if (replayed.done)
+               active--;
+            continue;
+         }
+         if (fds[i].revents & POLLOUT)
+            flushOut(replayed);
+         if (!replayed.done && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            onReadable(replayed, now);
+         if (replayed.done)
+            active--;
+      }
+   }
+   long long elapsed = now_us() - start;
+
+   size_t expected = 0;
+   for (size_t i = 0; i < scripts.size(); i++)
+      expected += scripts[i].expected.size() * copies;
+
+   cout << "replayed " << scripts.size() << " connections x " << copies
+        << " at ";
+   if (speed > 0)
+      cout << speed << "x";
+   else
+      cout << "max";
+   cout << " speed in " << elapsed / 1000 << " ms (captured in "
+        << duration / 1000 << " ms)\n"
+        << "frames: " << sent << " sent, " << samples.size() + extra
+        << " received of " << expected << " captured ("
+        << (elapsed ? (sent + samples.size()) * 1000000 / elapsed : 0)
+        << " frames/s)\n"
+        << "stalls: " << stalls << ", mismatched: " << mismatched
+        << ", extra: " << extra << ", busy: " << busy
+        << ", failed connects: " << failed << "\n";
+   report(duration);
+
+   return 0;
+}
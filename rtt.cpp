@@ -0,0 +1,56 @@
+#include "rtt.h"
+#include "constants.h" // PING_INTERVAL
+
+// a PING that got no PONG in that long is given up on (microseconds)
+static const long long PING_TIMEOUT = 5LL * PING_INTERVAL * 1000000;
+
+/******************************************************************************
+* RttProbe constructor - nothing measured yet, and the first PING is due
+******************************************************************************/
+RttProbe::RttProbe() :
+   smoothed(0), variation(0), samples(0), sentAt(0), lastSent(0)
+{
+}
+
+/******************************************************************************
+* isDue() - true if no PING is in flight (or it was lost) and the last one
+*           went out at least PING_INTERVAL ago
+******************************************************************************/
+bool RttProbe::isDue(long long now) const
+{
+   if (sentAt && now - sentAt < PING_TIMEOUT)
+      return false;
+   return !lastSent || now - lastSent >= PING_INTERVAL * 1000000LL;
+}
+
+/******************************************************************************
+* pinged() - remembers when the PING left
+******************************************************************************/
+void RttProbe::pinged(long long now)
+{
+   sentAt = now;
+   lastSent = now;
+}
+
+/******************************************************************************
+* ponged() - takes the sample. A PONG with no PING in flight is ignored.
+******************************************************************************/
+void RttProbe::ponged(long long now)
+{
+   if (!sentAt)
+      return;
+
+   long long rtt = now - sentAt;
+   sentAt = 0;
+
+   if (samples++ == 0)
+   {
+      smoothed = rtt;
+      variation = rtt / 2;
+      return;
+   }
+
+   long long error = (rtt > smoothed ? rtt - smoothed : smoothed - rtt);
+   variation += (error - variation) / 4;
+   smoothed += (rtt - smoothed) / 8;
+}
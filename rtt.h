@@ -0,0 +1,30 @@
+#ifndef RTT_H
+#define RTT_H
+
+/******************************************************************************
+* RttProbe Class - measures the round trip time of a connection with PING /
+*   PONG, one probe in flight at a time. The samples are smoothed the way TCP
+*   does it (RFC 6298): the estimate moves 1/8 of the way to each sample, and
+*   the variation 1/4 of the way to its distance from the estimate.
+******************************************************************************/
+class RttProbe
+{
+   public:
+      RttProbe();
+      bool isDue(long long now) const; // time for a new PING
+      void pinged(long long now);      // a PING was just sent
+      void ponged(long long now);      // its PONG just came back
+      bool isKnown() const { return samples > 0; }
+      long long getSmoothed() const { return smoothed; }   // microseconds
+      long long getVariation() const { return variation; } // microseconds
+      int getSamples() const { return samples; }
+
+   private:
+      long long smoothed;
+      long long variation;
+      int samples;
+      long long sentAt;   // now_us() of the PING in flight, 0 if none
+      long long lastSent; // now_us() of the last PING
+};
+
+#endif
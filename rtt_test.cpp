@@ -0,0 +1,104 @@
+#include <cstdio>   // printf
+#include "constants.h" // PING_INTERVAL
+#include "rtt.h"
+
+// a time the probe starts at: 0 is what it takes for no PING (microseconds)
+static const long long START = 1000000;
+static const long long INTERVAL = PING_INTERVAL * 1000000LL;
+
+/******************************************************************************
+* check() - reports a check of a case
+******************************************************************************/
+static bool check(const char* what, bool passed)
+{
+   printf("%-52s %s\n", what, passed ? "ok" : "FAILED");
+   return passed;
+}
+
+/******************************************************************************
+* sample() - a PING sent at now, its PONG rtt later
+******************************************************************************/
+static void sample(RttProbe& probe, long long now, long long rtt)
+{
+   probe.pinged(now);
+   probe.ponged(now + rtt);
+}
+
+/******************************************************************************
+* testSamples() - the first sample is the estimate, with half of it as the
+*                 variation. Later ones move them 1/8 and 1/4 of the way,
+*                 the variation against the estimate from before the sample.
+******************************************************************************/
+static bool testSamples()
+{
+   RttProbe probe;
+   bool passed = check("samples: nothing known before a PONG",
+                       !probe.isKnown() && probe.getSamples() == 0);
+
+   sample(probe, START, 8000);
+   passed &= check("samples: the first one is the estimate",
+                   probe.isKnown() && probe.getSmoothed() == 8000 &&
+                   probe.getVariation() == 4000);
+
+   sample(probe, START + INTERVAL, 16000);
+   // variation 4000 + (|16000 - 8000| - 4000) / 4, smoothed 8000 + 8000 / 8
+   passed &= check("samples: a later one moves them 1/8 and 1/4",
+                   probe.getSmoothed() == 9000 &&
+                   probe.getVariation() == 5000 && probe.getSamples() == 2);
+
+   sample(probe, START + 2 * INTERVAL, 1000);
+   // variation 5000 + (|1000 - 9000| - 5000) / 4, smoothed 9000 - 8000 / 8
+   passed &= check("samples: a faster one moves them the same",
+                   probe.getSmoothed() == 8000 &&
+                   probe.getVariation() == 5750);
+
+   for (int i = 3; i < 100; i++)
+      sample(probe, START + i * INTERVAL, 8000);
+   passed &= check("samples: a steady rtt, a steady estimate",
+                   probe.getSmoothed() == 8000 && probe.getVariation() < 10);
+   return passed;
+}
+
+/******************************************************************************
+* testProbing() - one PING in flight at a time, every PING_INTERVAL. A PONG
+*                 nobody waits for is no sample. A lost PING is given up on.
+******************************************************************************/
+static bool testProbing()
+{
+   RttProbe probe;
+   bool passed = check("probing: the first PING is due",
+                       probe.isDue(START));
+
+   probe.ponged(START);
+   passed &= check("probing: a PONG with no PING is ignored",
+                   !probe.isKnown());
+
+   probe.pinged(START);
+   passed &= check("probing: not due with a PING in flight",
+                   !probe.isDue(START + INTERVAL));
+   probe.ponged(START + 500);
+   passed &= check("probing: due again PING_INTERVAL after the last",
+                   !probe.isDue(START + INTERVAL - 1) &&
+                   probe.isDue(START + INTERVAL));
+
+   probe.ponged(START + 700);
+   passed &= check("probing: a second PONG is no second sample",
+                   probe.getSamples() == 1 && probe.getSmoothed() == 500);
+
+   probe.pinged(START + INTERVAL);
+   passed &= check("probing: a lost PING is given up on",
+                   !probe.isDue(START + 5 * INTERVAL) &&
+                   probe.isDue(START + 6 * INTERVAL));
+   return passed;
+}
+
+/******************************************************************************
+* main - the RTT probe's smoothing (RFC 6298) and pacing
+******************************************************************************/
+int main()
+{
+   bool passed = true;
+   passed &= testSamples();
+   passed &= testProbing();
+   return (passed ? 0 : 1);
+}
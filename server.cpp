@@ -15,393 +15,1161 @@
 *      understands the command, prompts the user for a user name, then sends
 *      that data back to the Server.
 *    - Pretty much every command the server gives to the client is executed
-*      from the loop found in play(). See play() and run() in the Client's side
+*      from the Match class (match.cpp). See run() in the Client's side
 ******************************************************************************/
 // #include <cstdlib>
 // #include <sys/socket.h>
 // #include <sys/types.h>
 
-#include <cstring>  // memcpy
+#include <cerrno>   // errno
+#include <cstdlib>  // atoi, exit, srand
+#include <algorithm> // min
+#include <csignal>  // signal, sigaction
+#include <cstring>  // memcpy, memset
+#include <fcntl.h>  // O_NONBLOCK, O_CLOEXEC
 #include <iostream> // cout
-#include <netdb.h>  // gethostbyname, hostent
-#include <netinet/in.h> // sockaddr_in
+#include <poll.h>   // poll
+#include <sys/epoll.h>  // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/resource.h> // getrlimit, setrlimit
+#include <sys/socket.h> // socketpair, recv
+#include <sys/wait.h> // waitpid
 #include <sstream> // stringstream
 #include <string>   // pop_back
-#include <unistd.h> // gethostname
+#include <unistd.h> // getopt, fork, close_range
+#include <list>
 #include <vector>
 
+#include "admission.h"
+#include "capture.h"
 #include "constants.h"
 #include "helpers.h"
+#include "listener.h"
+#include "logger.h"
+#include "match.h"
 #include "server.h"
+#include "transport.h"
+#include "worker.h"
 
 using namespace std;
 
+// fds the server needs besides its players': welcome sockets, workers, logs...
+const int FD_RESERVE = 64;
+
+// the write end of the Server's childFD pipe
+static int childWakeFD = ERROR_BAD;
+
+/******************************************************************************
+* onChildExit() - SIGCHLD handler: wakes the lobby's poll() up, so it reaps
+*                 the game (or worker) right away. Only a write() here, it
+*                 is async-signal-safe.
+******************************************************************************/
+static void onChildExit(int)
+{
+   int saved = errno;
+   char wake = 0;
+   if (write(childWakeFD, &wake, sizeof(wake)) < 0)
+      ; // full: the lobby is woken up already
+   errno = saved;
+}
+
+/******************************************************************************
+* fitFdLimit() - raises the open files limit as far as it goes, and lowers
+*                maxConnections (0 = no limit) to what the limit can hold.
+*                A connection can take 2 fds: its socket and its shared memory.
+******************************************************************************/
+static void fitFdLimit(int& maxConnections)
+{
+   struct rlimit limit;
+   if (getrlimit(RLIMIT_NOFILE, &limit) != ERROR_OK)
+      return;
+
+   if (limit.rlim_cur < limit.rlim_max)
+   {
+      limit.rlim_cur = limit.rlim_max;
+      if (setrlimit(RLIMIT_NOFILE, &limit) != ERROR_OK)
+         getrlimit(RLIMIT_NOFILE, &limit);
+   }
+
+   long long fit = ((long long)limit.rlim_cur - FD_RESERVE) / 2;
+   fit = (fit < 1 ? 1 : fit);
+   if (!maxConnections || maxConnections > fit)
+   {
+      LOG_WARN("{} open files at most, so {} connections at most instead of {}",
+               (long long)limit.rlim_cur, fit, maxConnections);
+      maxConnections = fit;
+   }
+}
 
 /******************************************************************************
 * MAIN
-* argv: port number
+* argv: [-w bot_wait_seconds] [-u socket_path] [-l address]... [-b backlog]
+*       [-r] [-v] [-W workers] [-c max_connections] [-i ip_rate]
+*       [-p max_waiting] [-t capture_file] port number
 ******************************************************************************/
 int main(int argc, char** argv)
 {
    int port = DEFAULT_PORT;
+   int botWait = DEFAULT_BOT_WAIT;
+   int backlog = DEFAULT_BACKLOG;
+   bool reusePort = false;
+   int workerCount = 0;
+   int maxConnections = DEFAULT_MAX_CONNECTIONS;
+   int ipRate = DEFAULT_IP_RATE;
+   int maxWaiting = DEFAULT_MAX_WAITING;
+   vector<const char*> addresses; // -l, see listener.h for the format
+   vector<const char*> unixPaths; // -u
+   const char* capturePath = NULL;
+   int option;
+
+   // -w: seconds a lone player waits before playing the bot (-1 = never)
+   // -u: also listen on a Unix domain socket, for clients on this host
+   // -l: listen on that address instead of every interface on PORT
+   // -b: backlog of each welcome socket
+   // -r: SO_REUSEPORT, so that several servers can share the port
+   // -v: verbose, log the DEBUG messages too
+   // -W: cluster mode, the games run in that many worker processes
+   // -c: most connections held at once, by the server and its games
+   // -i: most new connections per second from one IP address
+   // -p: most players waiting to be paired
+   //     (0 means no limit, for these last 3)
+   // -t: capture the traffic to that file, for replay
+   while ((option = getopt(argc, argv, "w:u:l:b:rvW:c:i:p:t:")) != -1)
+   {
+      if (option == 'w')
+         botWait = atoi(optarg);
+      else if (option == 'u')
+         unixPaths.push_back(optarg);
+      else if (option == 'l')
+         addresses.push_back(optarg);
+      else if (option == 'b')
+         backlog = atoi(optarg);
+      else if (option == 'r')
+         reusePort = true;
+      else if (option == 'v')
+         log_set_level(LEVEL_DEBUG);
+      else if (option == 'W')
+         workerCount = atoi(optarg);
+      else if (option == 'c')
+         maxConnections = atoi(optarg);
+      else if (option == 'i')
+         ipRate = atoi(optarg);
+      else if (option == 'p')
+         maxWaiting = atoi(optarg);
+      else if (option == 't')
+         capturePath = optarg;
+      else
+      {
+         cout << "Usage: " << argv[0]
+              << " [-w BOT_WAIT_SECONDS] [-u SOCKET_PATH] [-l ADDRESS]..."
+              << " [-b BACKLOG] [-r] [-v] [-W WORKERS] [-c MAX_CONNECTIONS]"
+              << " [-i IP_RATE] [-p MAX_WAITING] [-t CAPTURE_FILE] [PORT]\n";
+         exit(ERROR_BAD);
+      }
+   }
 
-   if (argc > 1)
+   if (optind < argc)
    {
       // convert the argument to an integer
       // Note: could use atoi(), but it can give segmentation faults...
-      stringstream ss(argv[1]);
+      stringstream ss(argv[optind]);
       ss >> port;
 
       if (!ss)
       {
          port = DEFAULT_PORT; // set it again so that the port won't be '0'
-         cout << "Failed to set the given port number. Using default port.\n";
+         LOG_WARN("Failed to set the given port number. Using default port.");
       }
    }
 
-   Server server(port);
+   // a player that hangs up must not kill the server on the next write
+   signal(SIGPIPE, SIG_IGN);
+   fitFdLimit(maxConnections);
+
+   // before any worker is forked, they all write to it
+   if (capturePath)
+   {
+      if (capture_start(capturePath) == ERROR_BAD)
+         exitErr("Failed to open the capture file");
+      LOG_INFO("Capturing the traffic to {}", capturePath);
+   }
+
+   Listener listener(backlog, reusePort);
+   if (addresses.empty())
+   {
+      stringstream wildcard;
+      wildcard << port;
+      listener.add(wildcard.str().c_str());
+   }
+   for (size_t i = 0; i < addresses.size(); i++)
+      listener.add(addresses[i]);
+   for (size_t i = 0; i < unixPaths.size(); i++)
+      listener.add((string("unix:") + unixPaths[i]).c_str());
+
+   // an IP may connect in bursts of twice its rate
+   Admission admission(maxConnections, ipRate, 2 * ipRate, maxWaiting);
+
+   Server server(listener, admission, botWait, workerCount);
    server.run();
 
    return 0;
 }
 
 /******************************************************************************
-* Server constructor
+* Server constructor - in cluster mode, starts the worker processes
 ******************************************************************************/
-Server::Server(int port)
+Server::Server(Listener& listener, Admission& admission, int botWait,
+               int workerCount)
+   : listener(listener), admission(admission), botWait(botWait), inGame(0)
 {
-   openSocket(port);
+   srand(getpid());
+   memset(&stats, 0, sizeof(stats));
+   nextStats = now_ms() + STATS_INTERVAL * 1000LL;
+
+   lobbyFD = epoll_create1(EPOLL_CLOEXEC);
+   if (lobbyFD == ERROR_BAD)
+      exitErr("Failed to create the lobby's epoll set");
+
+   // a game that ends frees its players' names (and seats) right away,
+   // not when the lobby happens to wake up next
+   int wake[2];
+   if (pipe2(wake, O_NONBLOCK | O_CLOEXEC) != ERROR_OK)
+      exitErr("Failed to create the child exit pipe");
+   childFD = wake[0];
+   childWakeFD = wake[1];
+   struct sigaction action;
+   memset(&action, 0, sizeof(action));
+   action.sa_handler = onChildExit;
+   action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+   sigemptyset(&action.sa_mask);
+   if (sigaction(SIGCHLD, &action, NULL) != ERROR_OK)
+      exitErr("Failed to catch SIGCHLD");
+
+   workers.resize(workerCount);
+   for (int i = 0; i < workerCount; i++)
+      spawnWorker(i);
 }
 
 /******************************************************************************
-* Server destructor
+* Server destructor - the welcome sockets are closed by the Listener. The
+*                     workers finish their games once their control socket
+*                     is closed.
 ******************************************************************************/
 Server::~Server()
 {
-   // make sure to close the socket
-   shutdown(socketFD, SHUT_RDWR);
-   close(socketFD);
+   for (size_t i = 0; i < workers.size(); i++)
+      close(workers[i].controlFD);
+   deletePlayers();
+   close(lobbyFD);
+   signal(SIGCHLD, SIG_DFL);
+   close(childFD);
+   close(childWakeFD);
+   childWakeFD = ERROR_BAD;
 }
 
 /******************************************************************************
 * run() - runs the server. Loops forever, listening for new player players to
 *         connect. When at least 2 players are available to play, start the
-*         game for them, then resume listening for new incoming connections
+*         game for them, then resume listening for new incoming connections.
+*         A player left waiting alone for botWait seconds plays the bot.
+*         Players in the lobby can also list who is waiting, and challenge
+*         one of them by name.
 ******************************************************************************/
 void Server::run()
 {
-   vector<Player*> players; // a vector of all connected players
-   vector<Player*> idle; // a vector of idle players
+   Matchmaker& queue = registry.getQueue(); // up for any game
 
    while(true)
    {
-      // let players connect
-      Player *player = NULL;
-      player = getPlayer(); // let a player connect
-      if (player)
-         players.push_back(player);
+      // wait for a new connection, but not past the lone player's bot
+      // deadline. In cluster mode, the workers report on their control
+      // sockets. The lobby's players all come through its epoll set, and
+      // the games that end through childFD
+      const vector<int>& listenFDs = listener.getFDs();
+      vector<struct pollfd> welcome(listenFDs.size() + workers.size() + 2);
+      for (size_t i = 0; i < welcome.size(); i++)
+      {
+         if (i < listenFDs.size())
+            welcome[i].fd = listenFDs[i];
+         else if (i < listenFDs.size() + workers.size())
+            welcome[i].fd = workers[i - listenFDs.size()].controlFD;
+         else if (i < welcome.size() - 1)
+            welcome[i].fd = lobbyFD;
+         else
+            welcome[i].fd = childFD;
+         welcome[i].events = POLLIN;
+         welcome[i].revents = 0;
+      }
 
-      // if there are 2 players connected, but not playing, make them play
-      getIdlePlayers(players, idle);
-      if (idle.size() > 1)
+      // let players connect ~ everyone that is queued, not just the first.
+      // Games that are over free their players' names first
+      if (capture_flush() == ERROR_BAD)
+         LOG_ERROR("Failed to write the capture, stopped capturing");
+      int timeout = getPollTimeout();
+      flushLobby(timeout);
+      int ready = poll(&welcome[0], welcome.size(), timeout);
+      if (ready > 0 && welcome.back().revents)
+      {
+         // the wake-ups first, so a child that ends after reapGames()
+         // wakes the next poll() up
+         char wakes[64];
+         while (read(childFD, wakes, sizeof(wakes)) > 0)
+            ;
+         welcome.back().revents = 0;
+      }
+      reapGames();
+      serveStalled();
+      if (ready > 0)
       {
-         // get the players that are not playing and make them "play"
-         Player* p1 = idle.front();
-         Player* p2 = idle.back();
-         p1->isPlaying = true;
-         p2->isPlaying = true;
-
-         // fork the process, such that the server can keep listening for new
-         // players....
-         // NOTE: could multi-thread instead of fork... (might do that for T2)
-         int pid = fork();
-         if (pid == 0)
-            play(p1, p2);
-         else if (pid == ERROR_BAD)
+         vector<Accepted> accepted;
+         for (size_t i = 0; i < welcome.size(); i++)
          {
-            cout << "FAILURE! Failed to fork the process\n";
+            if (!welcome[i].revents)
+               continue;
+            if (i < listenFDs.size())
+               listener.acceptAll(welcome[i].fd, accepted);
+            else if (i < listenFDs.size() + workers.size())
+               onWorkerReadable(i - listenFDs.size());
+            else
+               onLobbyReadable(); // childFD was handled before
          }
+
+         for (size_t i = 0; i < accepted.size(); i++)
+         {
+            capture_open(accepted[i].fd);
+
+            // turn the client away right now if the server is overloaded.
+            // Everybody in the lobby is waiting to be paired
+            int waiting = registry.getIdle().size();
+            int connections = waiting + inGame + greeting.size();
+            int admitted = admission.admit(accepted[i].address, connections,
+                                           waiting);
+            if (admitted != ADMITTED)
+            {
+               shed(accepted[i].fd, admitted);
+               continue;
+            }
+            stats.admitted++;
+            greet(accepted[i].fd); // the lobby reads the name when it comes
+         }
+      }
+      expireGreetings();
+
+      if (now_ms() >= nextStats)
+         logStats();
+
+      // make the players up for any game play whoever is close enough to
+      // their rating (how close widens as they wait)
+      Player* p1;
+      Player* p2;
+      while (queue.pair(p1, p2))
+      {
+         startMatch(p1, p2);
+         releasePlayer(p1);
+         releasePlayer(p2);
+      }
+
+      p1 = queue.getOldest();
+      if (p1 && botWait >= 0 &&
+          now_ms() - p1->idleSince >= botWait * 1000LL)
+      {
+         // nobody showed up in time, the bot takes the other seat
+         Player* bot = newBotPlayer();
+         startMatch(p1, bot);
+         releasePlayer(p1);
+         releasePlayer(bot);
       }
    }
+}
 
-   // once done running, deallocate each one of the allocated players
-   idle.clear();
-   deletePlayers(players);
+/******************************************************************************
+* startMatch() - in cluster mode, hands the players over to a worker.
+*                Otherwise (or if no worker takes them), forks the process
+*                that runs the game for them.
+******************************************************************************/
+void Server::startMatch(Player* p1, Player* p2)
+{
+   p1->isPlaying = true;
+   p2->isPlaying = true;
+
+   int humans = !p1->isBot + !p2->isBot;
+   stats.games++;
+
+   // send what the lobby still owes them while it can (what does not go
+   // now goes along with them, to the worker or the forked game)
+   if (!p1->isBot) transport_flush(p1->clientFD);
+   if (!p2->isBot) transport_flush(p2->clientFD);
+
+   // the registry keeps their names, as in a game of that process
+   int owner = (workers.empty() ? ERROR_BAD : handOff(p1, p2));
+   if (owner != ERROR_BAD)
+   {
+      inGame += humans;
+      if (!p1->isBot) registry.startGame(p1, owner);
+      if (!p2->isBot) registry.startGame(p2, owner);
+      return;
+   }
+
+   // fork the process, such that the server can keep listening for new
+   // players....
+   // NOTE: could multi-thread instead of fork... (might do that for T2)
+   // the game writes its result to a pipe: an exit status could also be a
+   // crash, or anything exit() got from deep down
+   int result[2];
+   if (pipe(result) != ERROR_OK)
+   {
+      LOG_WARN("Failed to create the result pipe, the game won't be rated");
+      result[0] = result[1] = ERROR_BAD;
+   }
+
+   capture_flush(); // or the game writes the lobby's records again
+   int pid = fork();
+   if (pid == 0)
+   {
+      srand(getpid()); // or every game's bot plays the same moves
+      closeLobby(p1, p2);
+      if (result[0] != ERROR_BAD)
+         close(result[0]);
+      int outcome = play(p1, p2);
+      if (write(result[1], &outcome, sizeof(outcome)) != sizeof(outcome))
+         LOG_WARN("Failed to report the result of the game to the lobby");
+      exit(ERROR_OK);
+   }
+
+   if (result[1] != ERROR_BAD)
+      close(result[1]);
+   if (pid == ERROR_BAD)
+   {
+      LOG_ERROR("FAILURE! Failed to fork the process");
+      if (result[0] != ERROR_BAD)
+         close(result[0]);
+      registry.leave(p1);
+      registry.leave(p2);
+   }
+   else
+   {
+      gamePids[pid].resultFD = result[0];
+      MatchReport& report = gamePids[pid].report;
+      strcpy(report.names[0], p1->name);
+      strcpy(report.names[1], p2->name);
+      report.isBot[0] = p1->isBot;
+      report.isBot[1] = p2->isBot;
+      report.result = NO_CONTEST;
+      inGame += humans;
+      if (!p1->isBot) registry.startGame(p1, pid);
+      if (!p2->isBot) registry.startGame(p2, pid);
+   }
 }
 
 /******************************************************************************
-* openSocket() - Opens the welcome socket and binds it to the given port
+* closeLobby() - in a forked game: closes the lobby's sockets but the
+*                players', so that the lobby hanging up on a client really
+*                hangs up on it
 ******************************************************************************/
-void Server::openSocket(int port)
+void Server::closeLobby(Player* p1, Player* p2)
 {
-   struct sockaddr_in socketAddress;
-   char hostname[MAXLEN];
-   struct hostent* hostEntry;
+   const list<Player*>& idle = registry.getIdle();
+   for (int i = 0; i < 2; i++)
+   {
+      const list<Player*>& players = (i == 0 ? idle : greeting);
+      for (list<Player*>::const_iterator it = players.begin();
+           it != players.end(); ++it)
+      {
+         if (*it != p1 && *it != p2)
+         {
+            transport_close((*it)->clientFD);
+            close((*it)->clientFD);
+         }
+      }
+   }
+
+   // the other games report to the lobby, not to this one
+   for (map<int, ForkedGame>::iterator it = gamePids.begin();
+        it != gamePids.end(); ++it)
+   {
+      if (it->second.resultFD != ERROR_BAD)
+         close(it->second.resultFD);
+   }
+   gamePids.clear();
 
-   // create the socket
-   socketFD = socket(AF_INET, SOCK_STREAM, 0); // domain, type, default prtocol
+   const vector<int>& listenFDs = listener.getFDs();
+   for (size_t i = 0; i < listenFDs.size(); i++)
+      close(listenFDs[i]);
+   close(lobbyFD);
+   signal(SIGCHLD, SIG_DFL);
+   close(childFD);
+   close(childWakeFD);
+}
 
-   // check if the socket got created appropriately
-   if (socketFD == ERROR_BAD)
+/******************************************************************************
+* spawnWorker() - starts (or restarts) the worker process in slot i. It gets
+*                 one end of a control socket, the lobby keeps the other.
+******************************************************************************/
+void Server::spawnWorker(size_t i)
+{
+   int control[2];
+   workers[i].pid = ERROR_BAD;
+   workers[i].controlFD = ERROR_BAD;
+   workers[i].load = 0;
+   workers[i].players = 0;
+
+   // SEQPACKET keeps each handoff / report a message of its own
+   if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, control) != ERROR_OK)
    {
-      exitErr("error on creating socket");
+      LOG_ERROR("FAILURE! Failed to create the control socket of worker {}", i);
+      return;
    }
+   int size = CONTROL_BUFFER; // the kernel may cap it, see handOff()
+   setsockopt(control[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
 
-   // get the hostname and hostaddress (hostent) of the server
-   gethostname(hostname, MAXLEN);
-   hostEntry = gethostbyname(hostname);
+   capture_flush(); // or the worker writes the lobby's records again
+   int pid = fork();
+   if (pid == 0)
+   {
+      // keep nothing of the lobby but stdio and the control socket, so that
+      // the lobby closing a player's socket really hangs up on the player
+      close_range(3, control[1] - 1, 0);
+      close_range(control[1] + 1, ~0U, 0);
+      transport_reset();
+      capture_reset();
+      signal(SIGCHLD, SIG_DFL);
+      srand(getpid());
 
-   // builds the socket info - family, address, port number
-   socketAddress.sin_family = AF_INET;
-   // socketAddress.sin_addr.s_addr = htonl(INADDR_ANY);
-   memcpy(&(socketAddress.sin_addr),
-          hostEntry->h_addr_list[0], hostEntry->h_length);
-   socketAddress.sin_port = htons(port);
+      Worker worker(control[1]);
+      worker.run();
+      exit(ERROR_OK);
+   }
 
-   // binds the socket data to the socketFD
-   if (bind(socketFD, (struct sockaddr *)&socketAddress,
-            sizeof(socketAddress)) != ERROR_OK)
+   close(control[1]);
+   if (pid == ERROR_BAD)
    {
-      // handle the error
-      exitErr("error on bind!");
+      LOG_ERROR("FAILURE! Failed to fork worker {}", i);
+      close(control[0]);
+      return;
    }
 
-   // listen for connections on that port
-   if (listen(socketFD, 1) != ERROR_OK)
+   workers[i].pid = pid;
+   workers[i].controlFD = control[0];
+   LOG_INFO("Worker {} started, pid {}", i, pid);
+}
+
+/******************************************************************************
+* handOff() - passes the players to the live worker with the fewest games.
+*             A worker that can't take them is restarted, and the players go
+*             to the new one. Returns the pid of the worker, or ERROR_BAD.
+*             A handoff too big for the control socket (the lobby holds a
+*             lot for the players) is no fault of the worker: ERROR_BAD, so
+*             a forked game takes them, buffers and all.
+******************************************************************************/
+int Server::handOff(Player* p1, Player* p2)
+{
+   size_t best = workers.size();
+   for (size_t i = 0; i < workers.size(); i++)
    {
-      // handle the error
-      exitErr("error on listen!");
+      if (workers[i].controlFD != ERROR_BAD &&
+          (best == workers.size() || workers[i].load < workers[best].load))
+         best = i;
    }
 
-   cout << "Socket opened successfully on port " << port << endl;
+   for (int attempt = 0; attempt < 2 && best < workers.size(); attempt++)
+   {
+      if (workers[best].controlFD != ERROR_BAD &&
+          sendMatch(workers[best].controlFD, p1, p2) == ERROR_OK)
+      {
+         workers[best].load++;
+         workers[best].players += !p1->isBot + !p2->isBot;
+         return workers[best].pid;
+      }
+      if (errno == EMSGSIZE)
+      {
+         LOG_WARN("Too much buffered to hand the game to a worker, forking it");
+         return ERROR_BAD;
+      }
+
+      LOG_ERROR("Worker {} did not take the game, restarting it", best);
+      restartWorker(best);
+   }
+   return ERROR_BAD;
 }
 
 /******************************************************************************
-* getPlayer() - listens, trying to accept() a connection from a new client.
-*               In addition, when the client connects, prompt the client for
-*                 the user name, saves that name and File Descriptor into the
-*                 Player* and then return it.
+* onWorkerReadable() - reads the worker's reports. If the control socket was
+*                      closed, the worker died (along with its games, but
+*                      nobody else's): start a new one in its place.
 ******************************************************************************/
-Player* Server::getPlayer()
+void Server::onWorkerReadable(size_t i)
 {
-   int clientFD = 0; // client File Descriptor / Socket Descriptor
-   Player* player = NULL;
+   MatchReport report;
+   ssize_t size;
 
-   // wait until a client connects
-   clientFD = accept(socketFD, NULL, NULL);
-   if (clientFD)
+   while ((size = recv(workers[i].controlFD, &report, sizeof(report),
+                       MSG_DONTWAIT)) > 0)
    {
-      player = new Player;
-      player->clientFD = clientFD;
+      workers[i].load--;
+      workers[i].players -= !report.isBot[0] + !report.isBot[1];
+      inGame -= !report.isBot[0] + !report.isBot[1];
+      for (int j = 0; j < 2; j++)
+      {
+         if (!report.isBot[j])
+            registry.endGame(report.names[j], workers[i].pid);
+      }
+      LOG_DEBUG("Worker {} finished '{}' VS '{}'", i, report.names[0],
+                report.names[1]);
+      rate(report);
+   }
 
-      // let the Client know that we want a name from it
-      write_data(player->clientFD, GET_NAME);
+   if (size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+   {
+      LOG_ERROR("Worker {} (pid {}) died, {} game(s) lost", i, workers[i].pid,
+                workers[i].load);
+      restartWorker(i);
+   }
+}
 
-      // read the name from the client and store it into the Player*
-      char buffer[MAXLEN] = "";
-      read_data(player->clientFD, buffer);
-      // TODO: validate the name he gave?? make sure there's a name?
-      strcpy(player->name, buffer);
+/******************************************************************************
+* restartWorker() - gives up on the worker in slot i (and its games), and
+*                   starts a new one in its place
+******************************************************************************/
+void Server::restartWorker(size_t i)
+{
+   inGame -= workers[i].players;
+   registry.endGames(workers[i].pid);
+   close(workers[i].controlFD);
+   spawnWorker(i);
+}
+
+/******************************************************************************
+* reapGames() - collects the game processes (and workers) that are over. A
+*               game that wrote no result to its pipe (it crashed, or was
+*               killed) is no contest.
+******************************************************************************/
+void Server::reapGames()
+{
+   int pid;
+   int status;
+   while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+   {
+      map<int, ForkedGame>::iterator it = gamePids.find(pid);
+      if (it != gamePids.end())
+      {
+         MatchReport& report = it->second.report;
+         inGame -= !report.isBot[0] + !report.isBot[1];
+         int result;
+         if (it->second.resultFD != ERROR_BAD)
+         {
+            if (read(it->second.resultFD, &result, sizeof(result)) ==
+                sizeof(result) && result >= P1 && result <= NO_CONTEST)
+               report.result = result;
+            close(it->second.resultFD);
+         }
+         rate(report);
+         gamePids.erase(it);
+      }
+      registry.endGames(pid);
    }
+}
 
-   return player;
+/******************************************************************************
+* rate() - updates the players' ratings with the result of their match. A
+*          match that ended before its first round does not count.
+******************************************************************************/
+void Server::rate(const MatchReport& report)
+{
+   if (report.result == NO_CONTEST)
+      return;
+
+   ratings.update(report.names[0], report.names[1], report.result);
+   LOG_DEBUG("Rated '{}' {} VS '{}' {}", report.names[0],
+             (int)ratings.get(report.names[0]), report.names[1],
+             (int)ratings.get(report.names[1]));
 }
 
 /******************************************************************************
-* play() - starts and runs the game for the 2 given players
+* shed() - turns the client away, before spending anything on it: one frame
+*          saying the server is busy, without waiting on the client, then
+*          hang up
 ******************************************************************************/
-void Server::play(Player* p1, Player* p2)
+void Server::shed(int clientFD, int reason)
 {
-   // these buffers will store the inputs of the players
-   char buffer1[MAXLEN] = "";
-   char buffer2[MAXLEN] = "";
+   char frame[sizeof(SERVER_BUSY) + 1];
+   frame[0] = sizeof(SERVER_BUSY); // the length, '\0' included
+   memcpy(frame + 1, SERVER_BUSY, sizeof(SERVER_BUSY));
+   send(clientFD, frame, sizeof(frame), MSG_DONTWAIT | MSG_NOSIGNAL);
+   capture_frame(clientFD, CAPTURE_OUT, SERVER_BUSY, strlen(SERVER_BUSY));
+   close(clientFD);
 
-   // will store the result from the read operations
-   int p1ReadResult;
-   int p2ReadResult;
+   if (reason == SHED_FULL)
+      stats.shedFull++;
+   else if (reason == SHED_RATE)
+      stats.shedRate++;
+   else
+      stats.shedWaiting++;
+   LOG_DEBUG("Turned a client away, reason {}", reason);
+}
 
-   // will store the player's inputs ~ r/p/s/q
-   char p1Choice;
-   char p2Choice;
+/******************************************************************************
+* logStats() - logs the counters
+******************************************************************************/
+void Server::logStats()
+{
+   LOG_INFO("Stats: {} admitted, {} games, {} in games",
+            stats.admitted, stats.games, inGame);
+   LOG_INFO("Stats: shed {} (full), {} (IP rate), {} (waiting), "
+            "{} (out of fds)", stats.shedFull, stats.shedRate,
+            stats.shedWaiting, listener.getDropped());
+   registry.getQueue().logStats();
+   nextStats = now_ms() + STATS_INTERVAL * 1000LL;
+}
 
-   // will store the winner of this round
-   int roundResult;
+/******************************************************************************
+* greet() - given a client that just connect()ed, prompts it for the user
+*           name. The answer is read by the lobby like any other frame (see
+*           onName()): nobody waits on the client, and a client that does
+*           not give its name within GREETING_TIMEOUT is hung up on.
+******************************************************************************/
+void Server::greet(int clientFD)
+{
+   Player* player = new Player(clientFD);
+   player->namesAsked = 1;
+   player->deadline = now_ms() + GREETING_TIMEOUT * 1000LL;
+   player->greetingPos = greeting.insert(greeting.end(), player);
+   player->lobbyEvents = EPOLLIN;
 
-   cout << "--------------------------------------------\n";
-   cout << "Starting a game - Process ID #" << getpid() << endl;
-   cout << "Players: '" << p1->name << "' VS '" << p2->name << "'\n";
+   struct epoll_event event;
+   event.events = EPOLLIN;
+   event.data.ptr = player;
+   if (epoll_ctl(lobbyFD, EPOLL_CTL_ADD, clientFD, &event) != ERROR_OK)
+   {
+      LOG_ERROR("Failed to greet a client");
+      dropPlayer(player);
+      return;
+   }
 
-   // let the players know who their oponents are
-   write_data(p1->clientFD, SET_OPPONENT);
-   write_data(p2->clientFD, SET_OPPONENT);
-   write_data(p1->clientFD, p2->name);
-   write_data(p2->clientFD, p1->name);
+   // the lobby never waits on a client: its writes are queued too
+   transport_queue_writes(clientFD);
+   sendTo(player, GET_NAME);
+}
 
-   // loop, sending a TURN command to the players
-   //  The TURN code means that the Server expects an input from the players.
-   //  Valid Inputs are: r/p/s/q for Rock, Paper, Scissors, Quit
-   // Then the server acts upon those results.
-   while(true)
+/******************************************************************************
+* onName() - the client's answer to the NAME prompt. Before giving its name,
+*            a client may answer with SHM (on the Unix socket: the
+*            connection moves to shared memory) and/or LOBBY (it will say
+*            who it wants to play, so it is not queued for any game yet).
+*            The name is asked again after each, up to 3 times in all; the
+*            last answer is the name, whatever it is. Returns false if the
+*            player left the lobby.
+******************************************************************************/
+bool Server::onName(Player* player, const char* answer)
+{
+   bool again = false;
+   if (player->namesAsked < 3 && !player->askedShm &&
+       strcmp(answer, SHM) == 0)
    {
-      // ask the clients to send their inputs for this turn
-      write_data(p1->clientFD, TURN);
-      write_data(p2->clientFD, TURN);
+      // what is queued for the socket must be out before the region is
+      player->askedShm = true;
+      if (transport_flush(player->clientFD) == ERROR_OK &&
+          !transport_backlog(player->clientFD))
+         shm_offer(player->clientFD); // falls back to the socket on failure
+      again = true;
+   }
+   else if (player->namesAsked < 3 && player->wantsAny &&
+            strcmp(answer, LOBBY) == 0)
+   {
+      player->wantsAny = false;
+      again = true;
+   }
 
-      // read the player's inputs for this turn
-      p1ReadResult = read_data(p1->clientFD, buffer1);
-      p2ReadResult = read_data(p2->clientFD, buffer2);
+   if (again)
+   {
+      player->namesAsked++;
+      sendTo(player, GET_NAME);
+      return true;
+   }
 
-      // store the player's inputs
-      p1Choice = buffer1[0];
-      p2Choice = buffer2[0];
+   greeting.erase(player->greetingPos);
+   strcpy(player->name, answer);
+   player->idleSince = now_ms();
+   player->lobbyState = IN_LOBBY;
+   join(player);
+   return true;
+}
 
-      // if the inputs were either PAPER, ROCK or SCISSORS
-      // then compute the results and send the results to the clients
-      if (p1Choice != QUIT && p2Choice != QUIT &&
-          p1ReadResult != ERROR_BAD && p2ReadResult != ERROR_BAD)
+/******************************************************************************
+* expireGreetings() - hangs up on the clients that did not give their name
+*                     in time. The oldest deadline comes first.
+******************************************************************************/
+void Server::expireGreetings()
+{
+   long long now = now_ms();
+   while (!greeting.empty() && greeting.front()->deadline <= now)
+   {
+      LOG_DEBUG("A client did not give its name in time");
+      dropPlayer(greeting.front());
+   }
+}
+
+/******************************************************************************
+* join() - the player gave its name and enters the lobby: it gets in the
+*          registry (which may rename it, if the name is taken). Its socket
+*          is already watched, for its commands now.
+******************************************************************************/
+void Server::join(Player* player)
+{
+   // the name may change, and the rating goes with the final one
+   registry.join(player, false);
+   player->rating = ratings.get(player->name);
+   registry.setQueued(player, player->wantsAny);
+   LOG_DEBUG("Player '{}' connected, rated {}", player->name,
+             (int)player->rating);
+
+   // the client must know the name, if it got a suffix: it is the one its
+   // opponents see, and challenge
+   if (sendTo(player, NAME_ACK) != ERROR_BAD)
+      sendTo(player, player->name);
+}
+
+/******************************************************************************
+* onLobbyReadable() - serves the players in the lobby that sent something,
+*                     the ones still giving their name included. Once one of
+*                     them left the lobby, the rest of the events may point
+*                     at players that are gone too: they wait for the next
+*                     round (epoll reports them again). A player that can be
+*                     written to again is flushed before the lobby sleeps.
+******************************************************************************/
+void Server::onLobbyReadable()
+{
+   struct epoll_event events[64];
+   int count = epoll_wait(lobbyFD, events, 64, 0);
+   for (int i = 0; i < count; i++)
+   {
+      Player* player = (Player*)events[i].data.ptr;
+      if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+          !serve(player))
+         break;
+   }
+}
+
+/******************************************************************************
+* serve() - handles every frame the player sent that arrived whole, without
+*           waiting on the rest of a partial one: its bytes wait for it.
+*           For shared memory, it then arms the doorbell so the next frame
+*           wakes up the lobby. A player whose queue is congested is not
+*           served any further: its input stays unread (stalled) until the
+*           queue drained, so asking for more than it reads can't grow the
+*           queue. One that failed is dropped. Returns false if the player
+*           (or anybody else) left the lobby.
+******************************************************************************/
+bool Server::serve(Player* player)
+{
+   int fd = player->clientFD;
+   char frame[MAXLEN] = "";
+   int length = 0;
+   do
+   {
+      while (true)
       {
-         // compute the winner
-         roundResult = getRoundResult(p1Choice, p2Choice);
-         switch(roundResult)
+         if (transport_failed(fd))
          {
-            case TIE :
-               write_data(p1->clientFD, DRAW);
-               write_data(p2->clientFD, DRAW);
-               break;
-            case P1 :
-               write_data(p1->clientFD, WIN);
-               write_data(p2->clientFD, LOSS);
-               break;
-            case P2 :
-               write_data(p1->clientFD, LOSS);
-               write_data(p2->clientFD, WIN);
-               break;
-            default:
-               cout << "Error calculating the round result!\n";
+            LOG_DEBUG("Dropping a client of the lobby, it is gone or too slow");
+            dropPlayer(player);
+            return false;
          }
-         // now that the DRAW / WIN LOSS was sent, build a nice string and
-         // send it to both clients
-         buildVerboseResult(p1Choice, p2Choice, buffer1, roundResult);
-         buildVerboseResult(p2Choice, p1Choice, buffer2, flip(roundResult));
-         write_data(p1->clientFD, buffer1);
-         write_data(p2->clientFD, buffer2);
+         if (transport_congested(fd))
+         {
+            stalled.insert(player);
+            return true;
+         }
+         if ((length = read_frame(fd, frame)) <= 0)
+            break;
+         if (!handleFrame(player, frame))
+            return false;
       }
-      else
+      if (length == ERROR_BAD)
       {
-         write_data(p1->clientFD, DC);
-         write_data(p2->clientFD, DC);
+         dropPlayer(player);
+         return false;
       }
+   } while (transport_pending(fd));
+
+   stalled.erase(player);
+   return true;
+}
+
+/******************************************************************************
+* serveStalled() - serves the stalled players whose queue drained: their
+*                  input already left the socket, so epoll won't report it
+*                  again. Stops once players left the lobby, like
+*                  onLobbyReadable(); the rest are served on the next round.
+******************************************************************************/
+void Server::serveStalled()
+{
+   vector<Player*> ready;
+   for (unordered_set<Player*>::iterator it = stalled.begin();
+        it != stalled.end(); ++it)
+   {
+      if (!transport_congested((*it)->clientFD))
+         ready.push_back(*it);
    }
+
+   for (size_t i = 0; i < ready.size(); i++)
+   {
+      if (!serve(ready[i]))
+         break;
+   }
+}
+
+/******************************************************************************
+* sendTo() - queues the message for the player in the lobby. The queue goes
+*            out before the lobby sleeps (see flushLobby()). Returns
+*            ERROR_BAD if the player failed: it is dropped there too.
+******************************************************************************/
+int Server::sendTo(Player* player, const char* msg)
+{
+   backlogged.insert(player);
+   return write_data(player->clientFD, msg);
 }
 
 /******************************************************************************
-* iterates through the vector of players, checking who isn't playing.
-* fills the idle vector with players that are not playing
+* flushLobby() - sends what is queued for the players in the lobby, without
+*                blocking. One whose queue does not drain is watched for
+*                POLLOUT, and not read from while it is congested (see
+*                transport_events(), which also lowers timeout for it). One
+*                that is gone, or too slow to keep, is dropped.
 ******************************************************************************/
-void Server::getIdlePlayers(const vector<Player*>& players,
-                            vector<Player*>& idle)
+void Server::flushLobby(int& timeout)
 {
-   idle.clear();
-   for (vector<Player*>::const_iterator cit = players.begin();
-        cit != players.end(); ++cit)
+   vector<Player*> failed;
+   for (unordered_set<Player*>::iterator it = backlogged.begin();
+        it != backlogged.end(); )
    {
-      if (!((*cit)->isPlaying))
+      Player* player = *it;
+      int fd = player->clientFD;
+      short events = EPOLLIN;
+      if (transport_flush(fd) == ERROR_BAD)
       {
-         idle.push_back(*cit); // if this player isn't playing, then push it...
+         failed.push_back(player);
+         ++it;
+         continue;
       }
+      if (transport_backlog(fd))
+      {
+         events = transport_events(fd, timeout);
+         ++it;
+      }
+      else
+         it = backlogged.erase(it);
+
+      // POLLIN and POLLOUT are EPOLLIN and EPOLLOUT
+      if (events != player->lobbyEvents)
+      {
+         struct epoll_event event;
+         event.events = events;
+         event.data.ptr = player;
+         epoll_ctl(lobbyFD, EPOLL_CTL_MOD, fd, &event);
+         player->lobbyEvents = events;
+      }
+   }
+
+   for (size_t i = 0; i < failed.size(); i++)
+   {
+      LOG_DEBUG("Dropping a client of the lobby, it is gone or too slow");
+      dropPlayer(failed[i]);
+   }
+
+   // drained enough to read the rest of what they asked for
+   for (unordered_set<Player*>::iterator it = stalled.begin();
+        it != stalled.end(); ++it)
+   {
+      if (!transport_congested((*it)->clientFD))
+         timeout = 0;
    }
 }
 
 /******************************************************************************
-* deletePlayers() - deallocates all the players that were previously allocated
+* handleFrame() - a frame from a player in the lobby: what it means depends
+*                 on where the player is in its dialog with the lobby.
+*                 Returns false if players left the lobby.
 ******************************************************************************/
-void Server::deletePlayers(vector<Player*>& players)
+bool Server::handleFrame(Player* player, const char* frame)
 {
-   for (vector<Player*>::iterator it = players.begin(); it != players.end(); ++it)
+   if (player->lobbyState == GREETING)
+      return onName(player, frame);
+
+   if (player->lobbyState == CHALLENGING)
    {
-      if (*it)
+      player->lobbyState = IN_LOBBY;
+      return challenge(player, frame);
+   }
+   return handleCommand(player, frame);
+}
+
+/******************************************************************************
+* handleCommand() - acts on a command of a player in the lobby. Returns
+*                   false if players left the lobby (this one among them).
+*                   CHAL only says the name of the challenged player comes
+*                   next.
+******************************************************************************/
+bool Server::handleCommand(Player* player, const char* command)
+{
+   if (strcmp(command, PLAY_ANY) == 0)
+   {
+      player->idleSince = now_ms(); // the bot's wait starts now
+      registry.setQueued(player, true);
+   }
+   else if (strcmp(command, WAIT_CHALLENGE) == 0)
+      registry.setQueued(player, false);
+   else if (strcmp(command, LIST_IDLE) == 0)
+      sendIdleList(player);
+   else if (strcmp(command, CHALLENGE) == 0)
+      player->lobbyState = CHALLENGING;
+   else
+      LOG_DEBUG("Ignored '{}' from '{}' in the lobby", command, player->name);
+   return true;
+}
+
+/******************************************************************************
+* sendIdleList() - sends LIST, the names of (up to LIST_MAX) other players
+*                  waiting in the lobby, oldest first, then an empty frame
+******************************************************************************/
+void Server::sendIdleList(Player* player)
+{
+   const list<Player*>& idle = registry.getIdle();
+   int sent = 0;
+
+   if (sendTo(player, LIST_IDLE) == ERROR_BAD)
+      return;
+   for (list<Player*>::const_iterator it = idle.begin();
+        it != idle.end() && sent < LIST_MAX; ++it)
+   {
+      if (*it != player)
       {
-         delete *it;
+         if (sendTo(player, (*it)->name) == ERROR_BAD)
+            return;
+         sent++;
       }
    }
-   players.clear();
+   sendTo(player, "");
 }
 
 /******************************************************************************
-* given the inputs ROCK / PAPER / SCISSOR for each player, return
-* the winner of that round.
-* possible outputs are: P1 / TIE / P2
+* challenge() - the player challenged the one by that name. If that player
+*               is waiting in the lobby, their game starts right away:
+*               returns false, the challenger is gone from the lobby.
+*               Otherwise the challenger gets NOPLR or INGAME.
 ******************************************************************************/
-int Server::getRoundResult(char p1Choice, char p2Choice)
+bool Server::challenge(Player* player, const char* name)
 {
-   int result = -99;
-
-   if (p1Choice == ROCK)
+   Player* opponent = registry.findIdle(name);
+   if (opponent && opponent != player)
    {
-      if      (p2Choice == ROCK)    result = TIE;
-      else if (p2Choice == PAPER)   result = P2;
-      else if (p2Choice == SCISSOR) result = P1;
+      LOG_DEBUG("'{}' challenged '{}'", player->name, opponent->name);
+      startMatch(player, opponent);
+      releasePlayer(player);
+      releasePlayer(opponent);
+      return false;
    }
-   else if (p1Choice == PAPER)
+
+   if (registry.getPresence(name) == PLAYING)
+      sendTo(player, IN_GAME);
+   else
+      sendTo(player, NO_PLAYER);
+   return true;
+}
+
+/******************************************************************************
+* dropPlayer() - the player hung up while in the lobby (or is hung up on).
+*                One that did not give its name is not in the registry yet.
+******************************************************************************/
+void Server::dropPlayer(Player* player)
+{
+   if (player->lobbyState == GREETING)
    {
-      if      (p2Choice == ROCK)    result = P1;
-      else if (p2Choice == PAPER)   result = TIE;
-      else if (p2Choice == SCISSOR) result = P2;
+      LOG_DEBUG("A client left before giving its name");
+      greeting.erase(player->greetingPos);
    }
-   else if (p1Choice == SCISSOR)
+   else
    {
-      if      (p2Choice == ROCK)    result = P2;
-      else if (p2Choice == PAPER)   result = P1;
-      else if (p2Choice == SCISSOR) result = TIE;
+      LOG_DEBUG("Player '{}' left the lobby", player->name);
+      registry.leave(player);
    }
-   return result;
+   releasePlayer(player);
 }
 
 /******************************************************************************
-* buildVerboseResult() - builds a string
+* play() - starts and runs the game for the 2 given players, in this process.
+*          Returns who won (Match::getResult()).
 ******************************************************************************/
-void Server::buildVerboseResult(char p1Choice, char p2Choice,
-                                char* buffer, int result)
+int Server::play(Player* p1, Player* p2)
 {
-   string msg;
-   string choice1 = getVerboseChoice(p1Choice);
-   string choice2 = getVerboseChoice(p2Choice);
+   Worker worker;
+   worker.add(new Match(p1, p2));
+   worker.run();
+   return worker.getLastResult();
+}
 
-   if (result == TIE)
-      msg = choice1 + " TIES against " + choice2 + "! Round DRAW!\n";
-   else if(result == P1)
-      msg = choice1 + " beats " + choice2 + "! You WIN!\n";
-   else if (result == P2)
-      msg = choice1 + " is beaten by " + choice2 + "! You LOSE!\n";
-   else
+/******************************************************************************
+* releasePlayer() - the player left the lobby (its game runs in another
+*                   process now, or it hung up): drop the server's copy of
+*                   the connection and forget the player
+******************************************************************************/
+void Server::releasePlayer(Player* player)
+{
+   if (!player->isBot)
    {
-      cout << "Invalid player choice! This should not have happened!\n";
-      cout << "the choice was: " << result << endl;
+      // the fd lives on in the game's process, so closing it here would
+      // not take it out of the epoll set
+      epoll_ctl(lobbyFD, EPOLL_CTL_DEL, player->clientFD, NULL);
+      transport_close(player->clientFD);
+      close(player->clientFD);
    }
+   backlogged.erase(player);
+   stalled.erase(player);
+   delete player;
+}
 
-   strcpy(buffer, msg.c_str()); // put the string into the buffer
+/******************************************************************************
+* getPollTimeout() - milliseconds the server may wait for a new connection
+*                    before a queued player's search widens, the oldest one
+*                    is owed the bot, a client runs out of time to give its
+*                    name, or the stats are due
+******************************************************************************/
+int Server::getPollTimeout()
+{
+   Matchmaker& queue = registry.getQueue();
+   long long deadline = nextStats;
+   if (!greeting.empty())
+      deadline = min(deadline, greeting.front()->deadline);
+   if (queue.getNextDue() >= 0)
+      deadline = min(deadline, queue.getNextDue());
+   if (queue.getOldest() && botWait >= 0)
+      deadline = min(deadline, queue.getOldest()->idleSince + botWait * 1000LL);
+
+   long long left = deadline - now_ms();
+   return (left > 0 ? (int)left : 0);
 }
 
 /******************************************************************************
-* getVerboseChoice() - returns the string representation of the choice
-*  'r' -> "ROCK"
-*  'p' -> "PAPER
-*  's' -> "SCISSORS"
+* newBotPlayer() - builds the Player entry for the server's bot
 ******************************************************************************/
-string Server::getVerboseChoice(char choice)
+Player* Server::newBotPlayer()
 {
-   if (choice == ROCK) return "ROCK";
-   return (choice == PAPER ? "PAPER" : "SCISSORS");
+   Player* bot = new Player(ERROR_BAD, BOT_NAME, true);
+   bot->rating = ratings.get(BOT_NAME);
+   return bot;
 }
 
 /******************************************************************************
-* flip() - flips the result - if P1 won, return P2, vice-versa...
+* deletePlayers() - hangs up on the players still in the lobby, and on the
+*                   clients that did not give their name yet
 ******************************************************************************/
-int Server::flip(int result)
+void Server::deletePlayers()
 {
-   int flippedResult = -99;
-   if (result == P1)       flippedResult = P2;
-   else if (result == P2)  flippedResult = P1;
-   else if (result == TIE) flippedResult = TIE;
-   return flippedResult;
+   while (!greeting.empty())
+      dropPlayer(greeting.front());
+
+   while (!registry.getIdle().empty())
+   {
+      Player* player = registry.getIdle().front();
+      registry.leave(player);
+      releasePlayer(player);
+   }
 }
@@ -1,16 +1,47 @@
-#ifndef CLIENT_H
-#define CLIENT_H
+#ifndef SERVER_H
+#define SERVER_H
 
+#include <list>
+#include <map>
+#include <unordered_set>
+#include "admission.h"
 #include "constants.h"
+#include "listener.h"
+#include "player.h"
+#include "ratings.h"
+#include "registry.h"
+#include "worker.h" // MatchReport
 
 /******************************************************************************
-* the Player struct
+* a worker process, as seen by the lobby ~ cluster mode
 ******************************************************************************/
-struct Player
+struct WorkerProcess
 {
-   bool isPlaying;    // flag indicating if that player is Playing a game
-   int clientFD;      // client File Descriptor / Socket Descriptor
-   char name[MAXLEN]; // the name of the player
+   int pid;
+   int controlFD; // the lobby's end of the control socket
+   int load;      // matches handed over and not reported over yet
+   int players;   // the human players in those matches
+};
+
+/******************************************************************************
+* a forked game, as seen by the lobby
+******************************************************************************/
+struct ForkedGame
+{
+   MatchReport report; // its players, and the result once it is over
+   int resultFD;       // the lobby's end of the pipe the game writes it to
+};
+
+/******************************************************************************
+* the server's counters, logged every STATS_INTERVAL seconds
+******************************************************************************/
+struct ServerStats
+{
+   long long admitted;    // connections that got past admission control
+   long long shedFull;    // turned away: too many connections
+   long long shedRate;    // turned away: their IP connects too often
+   long long shedWaiting; // turned away: too many players waiting
+   long long games;       // games started
 };
 
 /******************************************************************************
@@ -19,27 +50,64 @@ struct Player
 class Server
 {
    public:
-      Server(int = DEFAULT_PORT);
+      Server(Listener& listener, Admission& admission,
+             int = DEFAULT_BOT_WAIT, int workerCount = 0);
       ~Server();
       void run();
 
    private:
-      int socketFD; // the welcome socket File Descriptor
+      Listener& listener; // the welcome sockets
+      Admission& admission; // who gets in
+      Registry registry;  // the players online, by name
+      Ratings ratings;    // of everyone that finished a match, by name
+      int lobbyFD;  // epoll set of the sockets of the players in the lobby
+      int childFD;  // readable once a child process ended, see onChildExit()
+      std::unordered_set<Player*> backlogged; // lobby players with output
+      std::unordered_set<Player*> stalled; // input left unread, see serve()
+      int botWait;  // seconds before a lone player gets the bot, -1 = never
+      std::list<Player*> greeting; // not named yet, oldest deadline first
+      std::vector<WorkerProcess> workers; // cluster mode, empty otherwise
+      std::map<int, ForkedGame> gamePids; // forked games, by pid
+      int inGame;   // human players in games, in any process
+      ServerStats stats;
+      long long nextStats; // now_ms() of the next stats log
 
       // socket functionality
-      void openSocket(int port); // opens the server welcome socket
-      Player* getPlayer(); // accept() ~ listens for new players
+      void greet(int clientFD); // ask for the name, the lobby reads it
+      bool onName(Player* player, const char* answer);
+      void expireGreetings();
+      void shed(int clientFD, int reason); // turn the client away
+      void logStats();
+
+      // cluster mode
+      void spawnWorker(size_t i);
+      void restartWorker(size_t i);
+      int handOff(Player* p1, Player* p2);
+      void onWorkerReadable(size_t i);
+
+      // the lobby
+      void join(Player* player);
+      void onLobbyReadable();
+      bool serve(Player* player);
+      void serveStalled();
+      int sendTo(Player* player, const char* msg);
+      void flushLobby(int& timeout);
+      bool handleFrame(Player* player, const char* frame);
+      bool handleCommand(Player* player, const char* command);
+      void sendIdleList(Player* player);
+      bool challenge(Player* player, const char* name);
+      void dropPlayer(Player* player);
 
       // game processing methods
-      void play(Player* p1, Player* p2);
-      void getIdlePlayers(const std::vector<Player*>& players,
-                                std::vector<Player*>& idle);
-      void deletePlayers(std::vector<Player*>& players);
-      int getRoundResult(char p1Choice, char p2Choice);
-      void buildVerboseResult(char p1Choice, char p2Choice,
-                              char* buffer, int result);
-      std::string getVerboseChoice(char choice);
-      int flip(int result);
+      void startMatch(Player* p1, Player* p2);
+      void closeLobby(Player* p1, Player* p2);
+      int play(Player* p1, Player* p2);
+      void releasePlayer(Player* player);
+      void reapGames();
+      void rate(const MatchReport& report);
+      int getPollTimeout();
+      Player* newBotPlayer();
+      void deletePlayers();
 };
 
 #endif
@@ -0,0 +1,658 @@
+/******************************************************************************
+* Program:
+*    server_test - plays clients against a real server
+* Summary:
+*    Starts ./server on a free port of the loopback, in a process group of
+*    its own, and talks to it the way clients do, frame by frame. Each case
+*    checks what a client (or the server's own counters in /proc) can see,
+*    then the whole group is killed.
+******************************************************************************/
+#include <cerrno>   // errno
+#include <csignal>  // kill, SIGKILL
+#include <cstdio>   // printf
+#include <cstdlib>  // mkstemp, atoi
+#include <cstring>  // memset, strcmp
+#include <dirent.h> // opendir, readdir
+#include <fcntl.h>  // open
+#include <fstream>  // ifstream
+#include <sstream>  // stringstream
+#include <netinet/in.h> // sockaddr_in
+#include <poll.h>   // poll
+#include <arpa/inet.h>  // inet_pton
+#include <algorithm> // find
+#include <string>
+#include <sys/socket.h> // socket, connect, send, recv
+#include <sys/wait.h> // waitpid
+#include <unistd.h> // fork, execv, close
+#include <vector>
+
+#include "constants.h"
+#include "helpers.h" // now_ms
+
+using namespace std;
+
+const int START_TIMEOUT = 3000; // ms for the server to take connections
+const int FRAME_TIMEOUT = 2000; // ms a frame may take to come
+const int SLOW_PEER_WAIT = 14000; // ms for the server to drop a slow peer
+
+/******************************************************************************
+* a client connection, and what it received that is not a frame yet
+******************************************************************************/
+struct Conn
+{
+   int fd;
+   string in;
+};
+
+/******************************************************************************
+* freePort() - a port of the loopback nobody listens on right now
+******************************************************************************/
+static int freePort()
+{
+   int fd = socket(AF_INET, SOCK_STREAM, 0);
+   struct sockaddr_in address;
+   memset(&address, 0, sizeof(address));
+   address.sin_family = AF_INET;
+   inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+   socklen_t size = sizeof(address);
+   bind(fd, (struct sockaddr*)&address, size);
+   getsockname(fd, (struct sockaddr*)&address, &size);
+   close(fd);
+   return ntohs(address.sin_port);
+}
+
+/******************************************************************************
+* dial() - connects to the server, ERROR_BAD if it does not answer. A small
+*          receive buffer makes a client that does not read show up fast.
+******************************************************************************/
+static int dial(int port, int receiveBuffer = 0)
+{
+   int fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (receiveBuffer)
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer,
+                 sizeof(receiveBuffer));
+   struct sockaddr_in address;
+   memset(&address, 0, sizeof(address));
+   address.sin_family = AF_INET;
+   address.sin_port = htons(port);
+   inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+   if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != ERROR_OK)
+   {
+      close(fd);
+      return ERROR_BAD;
+   }
+   return fd;
+}
+
+/******************************************************************************
+* startServer() - runs ./server with the arguments on the port, its output
+*                 going to logPath. Returns its pid once it takes
+*                 connections, ERROR_BAD if it never does.
+******************************************************************************/
+static int startServer(const vector<string>& args, int port,
+                       const char* logPath)
+{
+   int pid = fork();
+   if (pid == 0)
+   {
+      setpgid(0, 0); // its workers and games die with it
+      int log = open(logPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      dup2(log, STDOUT_FILENO);
+      dup2(log, STDERR_FILENO);
+
+      vector<string> all(1, "./server");
+      all.insert(all.end(), args.begin(), args.end());
+      all.push_back(to_string(port));
+      vector<char*> argv;
+      for (size_t i = 0; i < all.size(); i++)
+         argv.push_back((char*)all[i].c_str());
+      argv.push_back(NULL);
+      execv(argv[0], &argv[0]);
+      _exit(ERROR_BAD);
+   }
+
+   long long deadline = now_ms() + START_TIMEOUT;
+   while (now_ms() < deadline)
+   {
+      int fd = dial(port);
+      if (fd != ERROR_BAD)
+      {
+         close(fd);
+         return pid;
+      }
+      usleep(10000);
+   }
+   kill(-pid, SIGKILL);
+   waitpid(pid, NULL, 0);
+   return ERROR_BAD;
+}
+
+/******************************************************************************
+* stopServer() - kills the server, its workers and its games
+******************************************************************************/
+static void stopServer(int pid)
+{
+   kill(-pid, SIGKILL);
+   waitpid(pid, NULL, 0);
+}
+
+/******************************************************************************
+* getMemory() - the peak resident size of the process, in kB (VmHWM)
+******************************************************************************/
+static long getMemory(int pid)
+{
+   ifstream status("/proc/" + to_string(pid) + "/status");
+   string key;
+   long value = 0;
+   while (status >> key)
+   {
+      if (key == "VmHWM:")
+      {
+         status >> value;
+         break;
+      }
+   }
+   return value;
+}
+
+/******************************************************************************
+* countZombies() - the children of the process that ended, and that it did
+*                  not collect yet
+******************************************************************************/
+static int countZombies(int pid)
+{
+   int count = 0;
+   DIR* proc = opendir("/proc");
+   struct dirent* entry;
+   while (proc && (entry = readdir(proc)))
+   {
+      ifstream stat(string("/proc/") + entry->d_name + "/stat");
+      string line;
+      if (!getline(stat, line) || line.rfind(')') == string::npos)
+         continue;
+
+      // after the name in parentheses: the state, then the parent's pid
+      stringstream fields(line.substr(line.rfind(')') + 1));
+      char state;
+      int parent;
+      if (fields >> state >> parent && state == 'Z' && parent == pid)
+         count++;
+   }
+   if (proc)
+      closedir(proc);
+   return count;
+}
+
+/******************************************************************************
+* sendFrame() - one frame: its length, the message, its '\0'
+******************************************************************************/
+static bool sendFrame(Conn& conn, const string& msg)
+{
+   string frame(1, (char)(msg.size() + 1));
+   frame += msg;
+   frame += '\0';
+   return send(conn.fd, frame.data(), frame.size(), MSG_NOSIGNAL) ==
+          (ssize_t)frame.size();
+}
+
+/******************************************************************************
+* recvFrame() - the next frame's message, waiting at most timeout ms for it.
+*               False if it did not come, or the server hung up.
+******************************************************************************/
+static bool recvFrame(Conn& conn, string& msg, int timeout = FRAME_TIMEOUT)
+{
+   long long deadline = now_ms() + timeout;
+   while (conn.in.empty() ||
+          conn.in.size() < 1 + (size_t)(unsigned char)conn.in[0])
+   {
+      struct pollfd pfd = { conn.fd, POLLIN, 0 };
+      long long left = deadline - now_ms();
+      if (left <= 0 || poll(&pfd, 1, (int)left) <= 0)
+         return false;
+      char buffer[4096];
+      ssize_t count = recv(conn.fd, buffer, sizeof(buffer), 0);
+      if (count <= 0)
+         return false;
+      conn.in.append(buffer, count);
+   }
+
+   int length = (unsigned char)conn.in[0];
+   msg = conn.in.substr(1, length);
+   msg = msg.substr(0, msg.find('\0'));
+   conn.in.erase(0, 1 + length);
+   return true;
+}
+
+/******************************************************************************
+* expect() - true if the next frame is that message
+******************************************************************************/
+static bool expect(Conn& conn, const string& wanted)
+{
+   string msg;
+   return recvFrame(conn, msg) && msg == wanted;
+}
+
+/******************************************************************************
+* login() - connects and gives the name, then reads the name the server
+*           acknowledged. With inLobby, the player says LOBBY first, so it
+*           is not paired with anybody until it asks.
+******************************************************************************/
+static bool login(Conn& conn, int port, const string& name, bool inLobby,
+                  int receiveBuffer = 0, string* named = NULL)
+{
+   conn.in.clear();
+   conn.fd = dial(port, receiveBuffer);
+   if (conn.fd == ERROR_BAD || !expect(conn, GET_NAME))
+      return false;
+   if (inLobby && (!sendFrame(conn, LOBBY) || !expect(conn, GET_NAME)))
+      return false;
+
+   string answer;
+   if (!sendFrame(conn, name) || !expect(conn, NAME_ACK) ||
+       !recvFrame(conn, answer))
+      return false;
+   if (named)
+      *named = answer;
+   return true;
+}
+
+/******************************************************************************
+* waitFor() - true once that message comes. The round trip probes on the
+*             way are answered, everything else is skipped.
+******************************************************************************/
+static bool waitFor(Conn& conn, const string& wanted)
+{
+   string msg;
+   while (recvFrame(conn, msg))
+   {
+      if (msg == wanted)
+         return true;
+      if (msg == PING && !sendFrame(conn, PONG))
+         return false;
+   }
+   return false;
+}
+
+/******************************************************************************
+* isClosed() - true if the server hangs up on the client within FRAME_TIMEOUT,
+*              whatever it sends before
+******************************************************************************/
+static bool isClosed(Conn& conn)
+{
+   long long deadline = now_ms() + FRAME_TIMEOUT;
+   while (now_ms() < deadline)
+   {
+      struct pollfd pfd = { conn.fd, POLLIN, 0 };
+      if (poll(&pfd, 1, FRAME_TIMEOUT) <= 0)
+         return false;
+      char buffer[4096];
+      if (recv(conn.fd, buffer, sizeof(buffer), 0) <= 0)
+         return true;
+   }
+   return false;
+}
+
+/******************************************************************************
+* findWorkers() - the pids of the workers the server logged as started, by
+*                 slot, the last one of each slot. Waits up to START_TIMEOUT
+*                 for count of them.
+******************************************************************************/
+static vector<int> findWorkers(const char* logPath, int count)
+{
+   vector<int> pids;
+   long long deadline = now_ms() + START_TIMEOUT;
+   do
+   {
+      pids.assign(count, ERROR_BAD);
+      ifstream log(logPath);
+      string line;
+      while (getline(log, line))
+      {
+         for (int i = 0; i < count; i++)
+         {
+            string started = "Worker " + to_string(i) + " started, pid ";
+            size_t at = line.find(started);
+            if (at != string::npos)
+               pids[i] = atoi(line.c_str() + at + started.size());
+         }
+      }
+      if (find(pids.begin(), pids.end(), ERROR_BAD) == pids.end())
+         break;
+      usleep(10000);
+   } while (now_ms() < deadline);
+   return pids;
+}
+
+/******************************************************************************
+* findInLog() - the first line of the log with that text, waiting up to
+*               FRAME_TIMEOUT for it to be written. Empty if there is none.
+******************************************************************************/
+static string findInLog(const char* logPath, const string& text)
+{
+   long long deadline = now_ms() + FRAME_TIMEOUT;
+   do
+   {
+      ifstream log(logPath);
+      string line;
+      while (getline(log, line))
+      {
+         if (line.find(text) != string::npos)
+            return line;
+      }
+      usleep(10000);
+   } while (now_ms() < deadline);
+   return "";
+}
+
+/******************************************************************************
+* isDropped() - true if the server hung up on a client that did not read for
+*               wait ms. Its FIN waits behind the data it could not send, so
+*               only then is that data read: a server that still serves the
+*               client would send far more than limit bytes before its end.
+******************************************************************************/
+static bool isDropped(Conn& conn, int wait, size_t limit)
+{
+   usleep(wait * 1000);
+   size_t received = 0;
+   long long deadline = now_ms() + FRAME_TIMEOUT;
+   while (received < limit && now_ms() < deadline)
+   {
+      struct pollfd pfd = { conn.fd, POLLIN, 0 };
+      if (poll(&pfd, 1, FRAME_TIMEOUT) <= 0)
+         return false;
+      char buffer[4096];
+      ssize_t count = recv(conn.fd, buffer, sizeof(buffer), 0);
+      if (count <= 0)
+         return true;
+      received += count;
+   }
+   return false;
+}
+
+/******************************************************************************
+* check() - reports a check of a case
+******************************************************************************/
+static bool check(const char* what, bool passed)
+{
+   printf("%-56s %s\n", what, passed ? "ok" : "FAILED");
+   return passed;
+}
+
+/******************************************************************************
+* testGameEnd() - the lobby must collect a forked game that ends right away,
+*                 while nothing else wakes it up: no zombie is left, and
+*                 challenging one of its players says nobody by that name
+*                 is here, not that the player is in a game
+******************************************************************************/
+static bool testGameEnd()
+{
+   int port = freePort();
+   vector<string> args = { "-i", "0", "-w", "-1" };
+   int pid = startServer(args, port, "/dev/null");
+   if (!check("game end: the server starts", pid != ERROR_BAD))
+      return false;
+
+   Conn a, b, c;
+   bool passed = login(c, port, "c", true);
+   passed &= login(a, port, "a", false) && login(b, port, "b", false);
+   passed &= waitFor(a, TURN) && waitFor(b, TURN);
+   passed &= sendFrame(a, string(1, QUIT));
+   passed &= check("game end: the game ends", waitFor(a, DC) && waitFor(b, DC));
+   usleep(200000);
+   passed &= check("game end: the lobby collects the game right away",
+                   countZombies(pid) == 0);
+
+   long long start = now_ms();
+   string answer = IN_GAME;
+   while (answer == IN_GAME && now_ms() - start < 500)
+   {
+      if (!sendFrame(c, CHALLENGE) || !sendFrame(c, "a") ||
+          !recvFrame(c, answer))
+         break;
+      if (answer == IN_GAME)
+         usleep(10000);
+   }
+   passed &= check("game end: the lobby frees the names right away",
+                   answer == NO_PLAYER);
+
+   close(a.fd);
+   close(b.fd);
+   close(c.fd);
+   stopServer(pid);
+   return passed;
+}
+
+/******************************************************************************
+* playRound() - one round of the game between the 2 players, a winning
+*               over b
+******************************************************************************/
+static bool playRound(Conn& a, Conn& b)
+{
+   return waitFor(a, TURN) && waitFor(b, TURN) &&
+          sendFrame(a, string(1, ROCK)) && sendFrame(b, string(1, SCISSOR)) &&
+          waitFor(a, WIN) && waitFor(b, LOSS);
+}
+
+/******************************************************************************
+* testRatings() - a quit never pays: quitting while ahead is no contest, and
+*                 quitting while behind is a loss. Nobody can pass for the
+*                 bot either: its name gets a suffix like a taken one.
+******************************************************************************/
+static bool testRatings()
+{
+   char logPath[] = "/tmp/server_test.XXXXXX";
+   close(mkstemp(logPath));
+   int port = freePort();
+   vector<string> args = { "-v", "-i", "0", "-w", "-1" };
+   int pid = startServer(args, port, logPath);
+   if (!check("ratings: the server starts", pid != ERROR_BAD))
+   {
+      unlink(logPath);
+      return false;
+   }
+
+   // a leads 1-0, then quits
+   Conn a, b;
+   bool passed = login(a, port, "a", false) && login(b, port, "b", false);
+   passed &= playRound(a, b) && waitFor(a, TURN) &&
+             sendFrame(a, string(1, QUIT)) && waitFor(b, DC);
+
+   // c leads 1-0, then d quits
+   Conn c, d;
+   passed &= login(c, port, "c", false) && login(d, port, "d", false);
+   passed &= playRound(c, d) && waitFor(d, TURN) &&
+             sendFrame(d, string(1, QUIT)) && waitFor(c, DC);
+   passed &= check("ratings: the games are played", passed);
+
+   string rated = findInLog(logPath, "Rated 'c'") +
+                  findInLog(logPath, "Rated 'd'");
+   passed &= check("ratings: quitting while behind is a loss",
+                   rated.find("'c' 1520") != string::npos &&
+                   rated.find("'d' 1480") != string::npos);
+   passed &= check("ratings: quitting while ahead is no contest",
+                   findInLog(logPath, "Rated 'a'").empty() &&
+                   findInLog(logPath, "Rated 'b'").empty());
+
+   Conn bot, other;
+   string named;
+   passed &= login(bot, port, BOT_NAME, true, 0, &named) &&
+             login(other, port, "other", true);
+   passed &= check("ratings: the client is told the name it got",
+                   named == string(BOT_NAME) + "#2");
+   bool listed = sendFrame(other, LIST_IDLE) && expect(other, LIST_IDLE);
+   string name;
+   vector<string> names;
+   while (listed && recvFrame(other, name) && !name.empty())
+      names.push_back(name);
+   passed &= check("ratings: a player can't take the bot's name",
+                   find(names.begin(), names.end(), BOT_NAME) == names.end() &&
+                   find(names.begin(), names.end(),
+                        string(BOT_NAME) + "#2") != names.end());
+
+   Conn* conns[] = { &a, &b, &c, &d, &bot, &other };
+   for (int i = 0; i < 6; i++)
+      close(conns[i]->fd);
+   stopServer(pid);
+   unlink(logPath);
+   return passed;
+}
+
+/******************************************************************************
+* testListFlood() - a lobby client asks for LIST over and over and never
+*                   reads the answers. The lobby must stop serving it once
+*                   its queue is congested, so the server's memory stays
+*                   put, must keep serving the others, and must drop it once
+*                   it made no progress for the slow peer timeout.
+******************************************************************************/
+static bool testListFlood()
+{
+   int port = freePort();
+   vector<string> args = { "-i", "0", "-w", "-1" };
+   int pid = startServer(args, port, "/dev/null");
+   if (!check("list flood: the server starts", pid != ERROR_BAD))
+      return false;
+
+   // long names, so every LIST answer is about 4 KB
+   bool passed = true;
+   vector<Conn> idle(LIST_MAX);
+   for (size_t i = 0; i < idle.size(); i++)
+      passed &= login(idle[i], port, to_string(i) + string(200, 'x'), true);
+   Conn flooder;
+   passed &= login(flooder, port, "flooder", true, 4096);
+   passed &= check("list flood: the players log in", passed);
+   usleep(100000);
+   long before = getMemory(pid);
+
+   // as many LISTs as the server takes in 2 seconds, up to 10000
+   string frame(1, (char)(sizeof(LIST_IDLE)));
+   frame += LIST_IDLE;
+   frame += '\0';
+   string flood;
+   for (int i = 0; i < 10000; i++)
+      flood += frame;
+   size_t sent = 0;
+   long long deadline = now_ms() + 2000;
+   while (sent < flood.size() && now_ms() < deadline)
+   {
+      ssize_t count = send(flooder.fd, flood.data() + sent,
+                           flood.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (count > 0)
+         sent += count;
+      else
+         usleep(1000);
+   }
+
+   // the lobby still answers the others right away
+   Conn& other = idle[0];
+   long long start = now_ms();
+   bool listed = sendFrame(other, LIST_IDLE) && expect(other, LIST_IDLE);
+   string name;
+   while (listed && recvFrame(other, name) && !name.empty())
+      ;
+   passed &= check("list flood: the lobby still answers LIST",
+                   listed && name.empty() && now_ms() - start < 500);
+
+   long after = getMemory(pid);
+   printf("  sent %zu LISTs, server peak memory %ld kB -> %ld kB\n",
+          sent / frame.size(), before, after);
+   passed &= check("list flood: the server's memory stays put",
+                   after - before < 8 * 1024);
+
+   passed &= check("list flood: the flooder is dropped",
+                   isDropped(flooder, SLOW_PEER_WAIT, 256 * 1024));
+
+   for (size_t i = 0; i < idle.size(); i++)
+      close(idle[i].fd);
+   close(flooder.fd);
+   stopServer(pid);
+   return passed;
+}
+
+/******************************************************************************
+* testWorkers() - cluster mode with 2 workers, a match in each. The first
+*                 match starts with a move its challenger sent along with
+*                 the challenge, so it was read by the lobby: it must reach
+*                 the worker. Killing that worker must end its match only:
+*                 the other worker's match plays on to its end, and the
+*                 lobby starts a new worker for the next matches.
+******************************************************************************/
+static bool testWorkers()
+{
+   char logPath[] = "/tmp/server_test.XXXXXX";
+   close(mkstemp(logPath));
+   int port = freePort();
+   vector<string> args = { "-i", "0", "-w", "-1", "-W", "2" };
+   int pid = startServer(args, port, logPath);
+   if (!check("workers: the server starts", pid != ERROR_BAD))
+   {
+      unlink(logPath);
+      return false;
+   }
+   vector<int> workerPids = findWorkers(logPath, 2);
+   bool passed = check("workers: both workers start",
+                       workerPids[0] != ERROR_BAD &&
+                       workerPids[1] != ERROR_BAD);
+
+   // the first match goes to worker 0: the challenge and the first move
+   // in one go, before the match even started
+   Conn a, b;
+   passed &= login(a, port, "a", true) && login(b, port, "b", true);
+   usleep(100000);
+   string frames;
+   const char* messages[] = { CHALLENGE, "a", "r" };
+   for (int i = 0; i < 3; i++)
+   {
+      frames += (char)(strlen(messages[i]) + 1);
+      frames += messages[i];
+      frames += '\0';
+   }
+   passed &= send(b.fd, frames.data(), frames.size(), MSG_NOSIGNAL) ==
+             (ssize_t)frames.size();
+   passed &= waitFor(a, TURN) && sendFrame(a, string(1, PAPER));
+   passed &= check("workers: a move read by the lobby reaches the match",
+                   waitFor(b, LOSS) && waitFor(a, WIN));
+
+   // the second one goes to worker 1, the one with fewer matches
+   Conn c, d;
+   passed &= login(c, port, "c", false) && login(d, port, "d", false);
+   passed &= check("workers: the second match starts",
+                   waitFor(c, TURN) && waitFor(d, TURN));
+
+   kill(workerPids[0], SIGKILL);
+   passed &= check("workers: the killed worker's match ends",
+                   isClosed(a) && isClosed(b));
+
+   passed &= sendFrame(c, string(1, ROCK)) && sendFrame(d, string(1, SCISSOR));
+   passed &= waitFor(c, WIN) && waitFor(d, LOSS);
+   passed &= waitFor(c, TURN) && sendFrame(c, string(1, QUIT));
+   passed &= check("workers: the other worker's match plays to its end",
+                   waitFor(c, DC) && waitFor(d, DC));
+
+   Conn e, f;
+   passed &= login(e, port, "e", false) && login(f, port, "f", false);
+   passed &= waitFor(e, TURN) && waitFor(f, TURN);
+   passed &= sendFrame(e, string(1, ROCK)) && sendFrame(f, string(1, ROCK));
+   passed &= check("workers: the lobby restarts the worker for new matches",
+                   findWorkers(logPath, 1)[0] != workerPids[0] &&
+                   waitFor(e, DRAW) && waitFor(f, DRAW));
+
+   Conn* conns[] = { &a, &b, &c, &d, &e, &f };
+   for (int i = 0; i < 6; i++)
+      close(conns[i]->fd);
+   stopServer(pid);
+   unlink(logPath);
+   return passed;
+}
+
+/******************************************************************************
+* main - each case runs a server of its own
+******************************************************************************/
+int main()
+{
+   bool passed = true;
+   passed &= testWorkers();
+   passed &= testGameEnd();
+   passed &= testRatings();
+   passed &= testListFlood();
+   return (passed ? 0 : 1);
+}
@@ -0,0 +1,933 @@
+#include <atomic>
+#include <cerrno>   // errno
+#include <string>
+#include <cstring>  // memcpy, strcmp, strlen
+#include <poll.h>   // poll
+#include <sched.h>  // sched_yield
+#include <fcntl.h>  // fcntl, F_ADD_SEALS
+#include <sys/mman.h>   // mmap, munmap, memfd_create
+#include <netinet/in.h>  // IPPROTO_TCP
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <sys/socket.h> // sendmsg, recvmsg, getsockname
+#include <unistd.h> // read, write, close, ftruncate
+#include <vector>
+#include "transport.h"
+#include "constants.h" // ERROR_BAD, ERROR_OK, SHM, NO_SHM
+#include "helpers.h"   // now_ms
+
+/******************************************************************************
+* the shared memory layout
+******************************************************************************/
+const unsigned SHM_RING_SIZE = 64 * 1024; // must be a power of 2
+const int SHM_SPIN = 2000; // empty checks before a reader goes to sleep
+
+struct ShmRing
+{
+   alignas(64) std::atomic<unsigned> head; // next byte written, producer only
+   alignas(64) std::atomic<unsigned> tail; // next byte read, consumer only
+   std::atomic<int> waiting; // consumer is asleep, waiting for the doorbell
+   alignas(64) char data[SHM_RING_SIZE];
+};
+
+struct ShmRegion
+{
+   ShmRing toClient;
+   ShmRing toServer;
+};
+
+// the other side can write anything anywhere in the region, so each side
+// keeps its own copy of the indices it owns, and checks the ones it reads
+struct ShmChannel
+{
+   int memFD; // kept, so the region can be handed to another process
+   ShmRegion* region;
+   ShmRing* in;  // the ring this side reads from
+   ShmRing* out; // the ring this side writes to
+   unsigned inTail;  // the next byte this side reads from in
+   unsigned outHead; // the next byte this side writes to out
+   bool broken;      // the other side broke the rings, nothing goes through
+};
+
+// the channels, indexed by the socket File Descriptor they were set up on
+static std::vector<ShmChannel*> channels;
+
+/******************************************************************************
+* the outbound queues ~ a connection that queues its writes never blocks the
+* writer. Above the high watermark it is congested, and stays congested until
+* it drains below the low one. A peer that takes nothing off its queue for
+* too long, or lets it grow past the hard limit, has failed.
+******************************************************************************/
+const size_t OUT_HIGH_WATERMARK = 16 * 1024;
+const size_t OUT_LOW_WATERMARK = 4 * 1024;
+const size_t OUT_HARD_LIMIT = 256 * 1024;
+const long long SLOW_PEER_TIMEOUT = 10000; // ms a queue may go without a write
+
+struct Outbound
+{
+   std::string data; // the queued bytes, from data[sent] on
+   size_t sent;
+   bool failed;      // the peer is gone, or too slow to keep
+   bool congested;
+   long long progressed; // now_ms() of the last write, or of the 1st byte queued
+};
+
+// the queues, indexed by the socket File Descriptor, NULL if not queued
+static std::vector<Outbound*> outbounds;
+
+/******************************************************************************
+* the inbound buffers ~ for event loops, which read whatever arrived without
+* blocking. The bytes wait here until they make a whole frame: 1 byte with
+* the length, then that many bytes (the message and its '\0').
+******************************************************************************/
+const int IN_READ_SIZE = 4096; // bytes read at once
+const size_t IN_BUFFER_LIMIT = 64 * 1024; // more waits in the kernel
+
+struct Inbound
+{
+   std::string data; // received, not handed out yet, from data[taken] on
+   size_t taken;
+   bool closed;      // the peer hung up (or broke the shared memory)
+};
+
+// the buffers, indexed by the socket File Descriptor, NULL until first used
+static std::vector<Inbound*> inbounds;
+
+/******************************************************************************
+* getOutbound() - returns the outbound queue of the fd, NULL if none
+******************************************************************************/
+static Outbound* getOutbound(int fd)
+{
+   if (fd < 0 || fd >= (int)outbounds.size())
+      return NULL;
+   return outbounds[fd];
+}
+
+/******************************************************************************
+* getInbound() - returns the inbound buffer of the fd, NULL if none
+******************************************************************************/
+static Inbound* getInbound(int fd)
+{
+   if (fd < 0 || fd >= (int)inbounds.size())
+      return NULL;
+   return inbounds[fd];
+}
+
+/******************************************************************************
+* getChannel() - returns the shared memory channel of the fd, NULL if none
+******************************************************************************/
+static ShmChannel* getChannel(int fd)
+{
+   if (fd < 0 || fd >= (int)channels.size())
+      return NULL;
+   return channels[fd];
+}
+
+/******************************************************************************
+* spinLimit() - how many times a reader checks an empty ring before it sleeps.
+*               On a single CPU the writer can't run while the reader spins,
+*               so there it goes to sleep right away.
+******************************************************************************/
+static int spinLimit()
+{
+   static int limit = (sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN : 0);
+   return limit;
+}
+
+/******************************************************************************
+* detach() - unmaps the fd's region, if it has one
+******************************************************************************/
+static void detach(int fd)
+{
+   ShmChannel* channel = getChannel(fd);
+   if (channel)
+   {
+      munmap(channel->region, sizeof(ShmRegion));
+      close(channel->memFD);
+      delete channel;
+      channels[fd] = NULL;
+   }
+}
+
+/******************************************************************************
+* attach() - maps the region and starts routing the fd's data through it. The
+*            fd's queues stay: what is queued goes through the region now.
+******************************************************************************/
+static int attach(int fd, int memFD, bool isServer)
+{
+   void* mem = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, memFD, 0);
+   if (mem == MAP_FAILED)
+   {
+      close(memFD);
+      return ERROR_BAD;
+   }
+
+   detach(fd); // in case the fd number had a previous life
+   ShmChannel* channel = new ShmChannel;
+   channel->memFD = memFD;
+   channel->region = (ShmRegion*)mem;
+   channel->in = isServer ? &channel->region->toServer
+                          : &channel->region->toClient;
+   channel->out = isServer ? &channel->region->toClient
+                           : &channel->region->toServer;
+   channel->inTail = channel->in->tail.load();
+   channel->outHead = channel->out->head.load();
+   channel->broken = false;
+
+   if (fd >= (int)channels.size())
+      channels.resize(fd + 1, NULL);
+   channels[fd] = channel;
+   return ERROR_OK;
+}
+
+/******************************************************************************
+* ringPush() - copies as much of the buffer as fits into the ring. Rings the
+*              doorbell if the consumer went to sleep. Returns bytes copied,
+*              or ERROR_BAD if the consumer's tail is not a possible one.
+******************************************************************************/
+static int ringPush(int fd, ShmChannel* channel, const char* buffer,
+                    int length)
+{
+   ShmRing* ring = channel->out;
+   unsigned head = channel->outHead;
+   unsigned used = head - ring->tail.load();
+   if (channel->broken || used > SHM_RING_SIZE)
+   {
+      channel->broken = true;
+      return ERROR_BAD;
+   }
+   unsigned space = SHM_RING_SIZE - used;
+   unsigned count = (unsigned)length < space ? length : space;
+
+   for (unsigned i = 0; i < count; i++)
+      ring->data[(head + i) & (SHM_RING_SIZE - 1)] = buffer[i];
+   channel->outHead = head + count;
+   ring->head.store(head + count);
+
+   if (count && ring->waiting.exchange(0))
+   {
+      char bell = 0;
+      send(fd, &bell, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+   }
+   return count;
+}
+
+/******************************************************************************
+* ringPop() - copies up to length bytes out of the ring. Returns bytes copied,
+*             or ERROR_BAD if the producer's head is not a possible one.
+******************************************************************************/
+static int ringPop(ShmChannel* channel, char* buffer, int length)
+{
+   ShmRing* ring = channel->in;
+   unsigned tail = channel->inTail;
+   unsigned avail = ring->head.load() - tail;
+   if (channel->broken || avail > SHM_RING_SIZE)
+   {
+      channel->broken = true;
+      return ERROR_BAD;
+   }
+   unsigned count = (unsigned)length < avail ? length : avail;
+
+   for (unsigned i = 0; i < count; i++)
+      buffer[i] = ring->data[(tail + i) & (SHM_RING_SIZE - 1)];
+   channel->inTail = tail + count;
+   ring->tail.store(tail + count);
+   return count;
+}
+
+/******************************************************************************
+* waitOnSocket() - sleeps on the socket until it is readable (doorbell), or
+*                  for at most timeout ms. Returns ERROR_BAD if the other side
+*                  closed the connection.
+******************************************************************************/
+static int waitOnSocket(int fd, int timeout)
+{
+   struct pollfd pfd;
+   pfd.fd = fd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   if (poll(&pfd, 1, timeout) > 0)
+   {
+      // drain the doorbells. 0 bytes means the other side is gone
+      char bells[64];
+      if (recv(fd, bells, sizeof(bells), MSG_DONTWAIT) == 0)
+         return ERROR_BAD;
+   }
+   return ERROR_OK;
+}
+
+/******************************************************************************
+* transport_read() - same contract as read(): blocks until at least 1 byte is
+*                    available, then returns how many bytes were read
+******************************************************************************/
+int transport_read(int fd, char* buffer, int length)
+{
+   ShmChannel* channel = getChannel(fd);
+   if (!channel)
+      return read(fd, buffer, length);
+
+   ShmRing* ring = channel->in;
+   while (true)
+   {
+      for (int spin = 0; spin < spinLimit(); spin++)
+      {
+         int count = ringPop(channel, buffer, length);
+         if (count)
+            return count;
+      }
+
+      // nothing yet. Ask for the doorbell, then check again before sleeping
+      // so a write that raced with us is not missed
+      ring->waiting.store(1);
+      int count = ringPop(channel, buffer, length);
+      if (count)
+         return count;
+      if (waitOnSocket(fd, -1) == ERROR_BAD)
+         return ERROR_BAD;
+   }
+}
+
+/******************************************************************************
+* hasFrame() - true if the buffer holds at least one whole frame
+******************************************************************************/
+static bool hasFrame(const Inbound* in)
+{
+   size_t left = in->data.size() - in->taken;
+   return left > 0 && left > (unsigned char)in->data[in->taken];
+}
+
+/******************************************************************************
+* readSome() - appends to the buffer what arrived, without blocking, up to
+*              IN_BUFFER_LIMIT. For shared memory, that also swallows the
+*              doorbells, and checks that the other side is still there.
+*              Sets closed if the peer hung up.
+******************************************************************************/
+static void readSome(int fd, Inbound* in)
+{
+   char buffer[IN_READ_SIZE];
+   ShmChannel* channel = getChannel(fd);
+   if (channel)
+   {
+      // the ring once more after the doorbells, or what came with the
+      // last one could wait for a bell that was already swallowed
+      for (int pass = 0; pass < 2; pass++)
+      {
+         while (in->data.size() < IN_BUFFER_LIMIT)
+         {
+            int count = ringPop(channel, buffer, sizeof(buffer));
+            if (count <= 0)
+               break;
+            in->data.append(buffer, count);
+         }
+         if (pass == 0 && waitOnSocket(fd, 0) == ERROR_BAD)
+            in->closed = true; // what it wrote before it left still counts
+      }
+      in->closed = in->closed || channel->broken;
+      return;
+   }
+
+   while (in->data.size() < IN_BUFFER_LIMIT)
+   {
+      int count = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if (count > 0)
+         in->data.append(buffer, count);
+      else if (count < 0 && errno == EINTR)
+         continue;
+      else
+      {
+         // 0: the peer hung up. EAGAIN: drained
+         if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            in->closed = true;
+         return;
+      }
+   }
+}
+
+/******************************************************************************
+* transport_read_frame() - for event loops: never blocks. Copies the next
+*                          whole frame's message into msg, and returns its
+*                          length (with the '\0'). Returns 0 if no whole
+*                          frame arrived yet: the bytes of a partial one wait
+*                          for the rest. ERROR_BAD once the peer hung up and
+*                          every whole frame it sent was read.
+******************************************************************************/
+int transport_read_frame(int fd, char* msg)
+{
+   if (fd < 0)
+      return ERROR_BAD;
+
+   Inbound* in = getInbound(fd);
+   if (!in)
+   {
+      if (fd >= (int)inbounds.size())
+         inbounds.resize(fd + 1, NULL);
+      in = inbounds[fd] = new Inbound;
+      in->taken = 0;
+      in->closed = false;
+   }
+
+   if (!hasFrame(in))
+   {
+      // don't let the frames handed out pile up in front of the buffer
+      in->data.erase(0, in->taken);
+      in->taken = 0;
+      readSome(fd, in);
+      if (!hasFrame(in))
+         return (in->closed ? ERROR_BAD : 0);
+   }
+
+   int length = (unsigned char)in->data[in->taken];
+   memcpy(msg, in->data.data() + in->taken + 1, length);
+   if (length == 0 || msg[length - 1] != '\0')
+      msg[length] = '\0'; // a frame without its '\0': still a string
+   in->taken += 1 + length;
+   return length;
+}
+
+/******************************************************************************
+* writeSome() - writes what it can of the buffer without blocking. Returns
+*               how many bytes, or ERROR_BAD if the peer is gone.
+******************************************************************************/
+static int writeSome(int fd, const char* buffer, int length)
+{
+   ShmChannel* channel = getChannel(fd);
+   if (channel)
+      return ringPush(fd, channel, buffer, length);
+
+   int count = send(fd, buffer, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+   if (count >= 0)
+      return count;
+   return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ?
+           0 : ERROR_BAD);
+}
+
+/******************************************************************************
+* checkQueue() - updates the congestion of the queue after it grew or shrank
+******************************************************************************/
+static void checkQueue(Outbound* out)
+{
+   size_t queued = out->data.size() - out->sent;
+   if (!out->congested && queued > OUT_HIGH_WATERMARK)
+      out->congested = true;
+   else if (out->congested && queued < OUT_LOW_WATERMARK)
+      out->congested = false;
+
+   if (queued > OUT_HARD_LIMIT)
+      out->failed = true;
+}
+
+/******************************************************************************
+* transport_write() - writes the whole buffer. Blocks until it is written,
+*                     unless the connection queues its writes: then the
+*                     buffer only joins the queue, and goes out with the
+*                     rest of it on the next transport_flush(). A buffer
+*                     that would take the queue past OUT_HARD_LIMIT fails
+*                     the peer instead, and is not queued: nothing grows
+*                     the queue of a failed peer.
+*                     Returns ERROR_BAD if the peer is gone (or too slow).
+******************************************************************************/
+int transport_write(int fd, const char* buffer, int length)
+{
+   Outbound* out = getOutbound(fd);
+   if (out)
+   {
+      if (out->failed ||
+          out->data.size() - out->sent + length > OUT_HARD_LIMIT)
+      {
+         out->failed = true;
+         return ERROR_BAD;
+      }
+      if (out->sent == out->data.size())
+         out->progressed = now_ms();
+      out->data.append(buffer, length);
+      checkQueue(out);
+      return (out->failed ? ERROR_BAD : length);
+   }
+
+   ShmChannel* channel = getChannel(fd);
+   if (!channel)
+   {
+      int sent = 0;
+      while (sent < length)
+      {
+         int count = send(fd, buffer + sent, length - sent, MSG_NOSIGNAL);
+         if (count < 0 && errno != EINTR)
+            return ERROR_BAD;
+         if (count > 0)
+            sent += count;
+      }
+      return sent;
+   }
+
+   int sent = 0;
+   int spin = 0;
+   while (sent < length)
+   {
+      int count = ringPush(fd, channel, buffer + sent, length - sent);
+      if (count == ERROR_BAD)
+         return ERROR_BAD;
+      sent += count;
+      if (count)
+         spin = 0;
+      else if (++spin < spinLimit())
+         sched_yield();
+      else if (waitOnSocket(fd, 1) == ERROR_BAD) // the reader is slow or dead
+         return ERROR_BAD;
+   }
+   return sent;
+}
+
+/******************************************************************************
+* transport_queue_writes() - from now on, writes to the fd never block: they
+*                            are queued, until the owner flushes them. All the
+*                            frames of a turn then leave in a single send(),
+*                            instead of one small segment each.
+******************************************************************************/
+void transport_queue_writes(int fd)
+{
+   if (fd < 0 || getOutbound(fd))
+      return;
+
+   // keep the kernel's own buffer small, or a peer that stopped reading
+   // could hide megabytes in it before the queue ever noticed. The queue
+   // already batches the frames, so Nagle would only delay them (and the
+   // PONGs that measure the round trip). Neither applies to Unix sockets.
+   if (!getChannel(fd))
+   {
+      int size = OUT_HIGH_WATERMARK;
+      int on = 1;
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+   }
+
+   if (fd >= (int)outbounds.size())
+      outbounds.resize(fd + 1, NULL);
+   outbounds[fd] = new Outbound;
+   outbounds[fd]->sent = 0;
+   outbounds[fd]->failed = false;
+   outbounds[fd]->congested = false;
+   outbounds[fd]->progressed = 0;
+}
+
+/******************************************************************************
+* transport_flush() - writes what it can of the fd's queue, without blocking.
+*                     Returns ERROR_BAD once the peer has failed.
+******************************************************************************/
+int transport_flush(int fd)
+{
+   Outbound* out = getOutbound(fd);
+   if (!out)
+      return ERROR_OK;
+
+   while (!out->failed && out->sent < out->data.size())
+   {
+      int count = writeSome(fd, out->data.data() + out->sent,
+                            out->data.size() - out->sent);
+      if (count == ERROR_BAD)
+         out->failed = true;
+      else if (count == 0)
+         break; // full, try again when it is writable
+      else
+      {
+         out->sent += count;
+         out->progressed = now_ms();
+      }
+   }
+
+   // don't let the written part pile up in front of the queue
+   if (out->sent == out->data.size())
+   {
+      out->data.clear();
+      out->sent = 0;
+   }
+   else if (out->sent >= OUT_LOW_WATERMARK)
+   {
+      out->data.erase(0, out->sent);
+      out->sent = 0;
+   }
+
+   checkQueue(out);
+   return (transport_failed(fd) ? ERROR_BAD : ERROR_OK);
+}
+
+/******************************************************************************
+* transport_backlog() - how many bytes the fd's queue still holds
+******************************************************************************/
+size_t transport_backlog(int fd)
+{
+   Outbound* out = getOutbound(fd);
+   return (out ? out->data.size() - out->sent : 0);
+}
+
+/******************************************************************************
+* transport_congested() - true while the fd's queue is above the high
+*                         watermark, and not back below the low one yet.
+*                         Its owner should not read what would make it
+*                         queue even more.
+******************************************************************************/
+bool transport_congested(int fd)
+{
+   Outbound* out = getOutbound(fd);
+   return (out && out->congested);
+}
+
+/******************************************************************************
+* transport_failed() - true if the peer is gone, or has not read anything for
+*                      longer than SLOW_PEER_TIMEOUT while data waited for it
+******************************************************************************/
+bool transport_failed(int fd)
+{
+   Outbound* out = getOutbound(fd);
+   if (!out)
+      return false;
+
+   if (out->sent < out->data.size() &&
+       now_ms() - out->progressed > SLOW_PEER_TIMEOUT)
+      out->failed = true;
+   return out->failed;
+}
+
+/******************************************************************************
+* transport_events() - for event loops: the poll() events to wait for on the
+*                      fd. While the peer is congested, its input is not
+*                      read, so it can't make the server queue even more for
+*                      it. Lowers timeout when the fd needs attention sooner
+*                      than poll() could tell.
+******************************************************************************/
+short transport_events(int fd, int& timeout)
+{
+   short events = POLLIN;
+   Outbound* out = getOutbound(fd);
+
+   if (out && out->failed)
+      timeout = 0; // its owner has to drop it right away
+
+   if (out && out->sent < out->data.size())
+   {
+      // shared memory has no POLLOUT, so it is retried soon. Either way the
+      // owner wakes up often enough to notice a peer that stopped reading.
+      int retry = (getChannel(fd) ? 1 : 1000);
+      timeout = (timeout < 0 || timeout > retry ? retry : timeout);
+      if (!getChannel(fd))
+         events |= POLLOUT;
+   }
+
+   if (out && out->congested)
+      events &= ~POLLIN;
+   else if (transport_pending(fd))
+      timeout = 0; // shared memory that already has data
+
+   return events;
+}
+
+/******************************************************************************
+* transport_pending() - for event loops that poll() the socket. True if the
+*                       shared memory already has data to read. Otherwise it
+*                       asks for the doorbell, so the socket becomes readable
+*                       as soon as data arrives. Always false for a socket.
+******************************************************************************/
+bool transport_pending(int fd)
+{
+   Inbound* in = getInbound(fd);
+   if (in && hasFrame(in))
+      return true; // read already, not handed out yet
+
+   ShmChannel* channel = getChannel(fd);
+   if (!channel)
+      return false;
+
+   // a broken channel is "readable", so the read reports it
+   ShmRing* ring = channel->in;
+   if (channel->broken || ring->head.load() != channel->inTail)
+      return true;
+
+   ring->waiting.store(1);
+   return ring->head.load() != channel->inTail;
+}
+
+/******************************************************************************
+* transport_readable() - after poll() said the socket is readable: true if a
+*                        read won't block. For shared memory, the socket may
+*                        only have had doorbells for data already read, so
+*                        swallow them and check the ring. True as well if the
+*                        other side hung up, so the read reports it.
+******************************************************************************/
+bool transport_readable(int fd)
+{
+   if (!getChannel(fd))
+      return true;
+   if (waitOnSocket(fd, 0) == ERROR_BAD)
+      return true;
+   return transport_pending(fd);
+}
+
+/******************************************************************************
+* transport_shm_fd() - the fd of the shared memory behind the connection, to
+*                      pass along with the socket. ERROR_BAD if there is none.
+******************************************************************************/
+int transport_shm_fd(int fd)
+{
+   ShmChannel* channel = getChannel(fd);
+   return (channel ? channel->memFD : ERROR_BAD);
+}
+
+/******************************************************************************
+* transport_adopt_shm() - server side, in the process the connection (and its
+*                         shared memory) was passed to: attach to it again
+******************************************************************************/
+int transport_adopt_shm(int fd, int memFD)
+{
+   return attach(fd, memFD, true);
+}
+
+/******************************************************************************
+* transport_buffered() - the bytes this process holds for the connection:
+*                        what it read and did not hand out yet (in), and
+*                        what it queued and did not send yet (out). They
+*                        go along with the connection to another process.
+******************************************************************************/
+void transport_buffered(int fd, std::string& in, std::string& out)
+{
+   Inbound* inbound = getInbound(fd);
+   Outbound* outbound = getOutbound(fd);
+   in = (inbound ? inbound->data.substr(inbound->taken) : "");
+   out = (outbound ? outbound->data.substr(outbound->sent) : "");
+}
+
+/******************************************************************************
+* transport_adopt_buffered() - server side, in the process the connection was
+*                              passed to: takes the bytes the other process
+*                              held for it. The input is handed out before
+*                              anything read from now on, and the output
+*                              is queued before anything written.
+******************************************************************************/
+void transport_adopt_buffered(int fd, const std::string& in,
+                              const std::string& out)
+{
+   if (fd < 0)
+      return;
+
+   if (!in.empty())
+   {
+      if (fd >= (int)inbounds.size())
+         inbounds.resize(fd + 1, NULL);
+      delete inbounds[fd];
+      inbounds[fd] = new Inbound;
+      inbounds[fd]->data = in;
+      inbounds[fd]->taken = 0;
+      inbounds[fd]->closed = false;
+   }
+
+   if (!out.empty())
+   {
+      transport_queue_writes(fd);
+      Outbound* outbound = getOutbound(fd);
+      outbound->data += out;
+      outbound->progressed = now_ms();
+      checkQueue(outbound);
+   }
+}
+
+/******************************************************************************
+* transport_close() - drops the fd's queues and detaches its shared memory,
+*                     if it has any. The socket itself is left for the
+*                     caller to close.
+******************************************************************************/
+void transport_close(int fd)
+{
+   Outbound* out = getOutbound(fd);
+   if (out)
+   {
+      delete out;
+      outbounds[fd] = NULL;
+   }
+
+   Inbound* in = getInbound(fd);
+   if (in)
+   {
+      delete in;
+      inbounds[fd] = NULL;
+   }
+
+   detach(fd);
+}
+
+/******************************************************************************
+* transport_reset() - forgets every shared memory channel and queue, without
+*                     closing anything. For a forked process that already
+*                     closed the fds it inherited.
+******************************************************************************/
+void transport_reset()
+{
+   for (size_t fd = 0; fd < outbounds.size(); fd++)
+   {
+      delete outbounds[fd];
+      outbounds[fd] = NULL;
+   }
+
+   for (size_t fd = 0; fd < inbounds.size(); fd++)
+   {
+      delete inbounds[fd];
+      inbounds[fd] = NULL;
+   }
+
+   for (size_t fd = 0; fd < channels.size(); fd++)
+   {
+      if (channels[fd])
+      {
+         munmap(channels[fd]->region, sizeof(ShmRegion));
+         delete channels[fd];
+         channels[fd] = NULL;
+      }
+   }
+}
+
+/******************************************************************************
+* isLocalSocket() - true if the fd is connected through a Unix domain socket
+******************************************************************************/
+bool isLocalSocket(int fd)
+{
+   struct sockaddr_storage address;
+   socklen_t length = sizeof(address);
+   if (getsockname(fd, (struct sockaddr*)&address, &length) != ERROR_OK)
+      return false;
+   return address.ss_family == AF_UNIX;
+}
+
+/******************************************************************************
+* isSocketPath() - true if the "host" given to the client is the path of the
+*                  server's Unix domain socket rather than a hostname
+******************************************************************************/
+bool isSocketPath(const char* host)
+{
+   return strchr(host, '/') != NULL;
+}
+
+/******************************************************************************
+* shm_offer() - answers a client's SHM request. Creates the region and sends
+*               it in an "SHM" frame, passing the memory's fd along with it
+*               (SCM_RIGHTS). Sends "NOSHM" if the client is not local or the
+*               region can't be created. From then on, the data flows through
+*               the region. The region's size is sealed before it is sent, so
+*               the client can't shrink it under the server's mapping (which
+*               would SIGBUS the server on its next access).
+******************************************************************************/
+int shm_offer(int fd)
+{
+   int memFD = ERROR_BAD;
+   if (isLocalSocket(fd))
+   {
+      memFD = memfd_create("rps-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+      if (memFD != ERROR_BAD &&
+          (ftruncate(memFD, sizeof(ShmRegion)) != ERROR_OK ||
+           fcntl(memFD, F_ADD_SEALS,
+                 F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != ERROR_OK))
+      {
+         close(memFD);
+         memFD = ERROR_BAD;
+      }
+   }
+
+   // frame: 1 byte with the length, then the message and its '\0'
+   const char* msg = (memFD == ERROR_BAD ? NO_SHM : SHM);
+   char frame[MAXLEN];
+   frame[0] = strlen(msg) + 1;
+   strcpy(frame + 1, msg);
+
+   struct iovec iov;
+   iov.iov_base = frame;
+   iov.iov_len = frame[0] + 1;
+
+   union
+   {
+      struct cmsghdr align;
+      char buffer[CMSG_SPACE(sizeof(int))];
+   } control;
+
+   struct msghdr header;
+   memset(&header, 0, sizeof(header));
+   header.msg_iov = &iov;
+   header.msg_iovlen = 1;
+
+   if (memFD != ERROR_BAD)
+   {
+      header.msg_control = control.buffer;
+      header.msg_controllen = sizeof(control.buffer);
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &memFD, sizeof(int));
+   }
+
+   if (sendmsg(fd, &header, MSG_NOSIGNAL) != (ssize_t)iov.iov_len)
+   {
+      if (memFD != ERROR_BAD)
+         close(memFD);
+      return ERROR_BAD;
+   }
+
+   if (memFD == ERROR_BAD)
+      return ERROR_BAD;
+   return attach(fd, memFD, true);
+}
+
+/******************************************************************************
+* shm_accept() - reads the server's answer to the SHM request. If the server
+*                sent the region, attach to it. Returns ERROR_BAD if the
+*                connection stays on the socket.
+******************************************************************************/
+int shm_accept(int fd)
+{
+   char length = 0;
+   struct iovec iov;
+   iov.iov_base = &length;
+   iov.iov_len = 1;
+
+   union
+   {
+      struct cmsghdr align;
+      char buffer[CMSG_SPACE(sizeof(int))];
+   } control;
+
+   struct msghdr header;
+   memset(&header, 0, sizeof(header));
+   header.msg_iov = &iov;
+   header.msg_iovlen = 1;
+   header.msg_control = control.buffer;
+   header.msg_controllen = sizeof(control.buffer);
+
+   // the fd rides along with the first byte of the frame
+   if (recvmsg(fd, &header, MSG_CMSG_CLOEXEC) != 1)
+      return ERROR_BAD;
+
+   int memFD = ERROR_BAD;
+   struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+   if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&memFD, CMSG_DATA(cmsg), sizeof(int));
+
+   // now read the rest of the frame
+   char msg[MAXLEN];
+   int i = 0;
+   while (i < length)
+   {
+      int count = read(fd, msg + i, length - i);
+      if (count <= 0)
+      {
+         if (memFD != ERROR_BAD)
+            close(memFD);
+         return ERROR_BAD;
+      }
+      i += count;
+   }
+
+   if (memFD == ERROR_BAD)
+      return ERROR_BAD;
+   if (strcmp(msg, SHM) != 0)
+   {
+      close(memFD);
+      return ERROR_BAD;
+   }
+   return attach(fd, memFD, false);
+}
@@ -0,0 +1,45 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <cstddef> // size_t
+#include <string>
+
+/******************************************************************************
+* TRANSPORT - moves the bytes of a connection. By default that is the socket
+*   itself. A client on the same host, connected through the Unix domain
+*   socket, can ask for a shared memory region instead: two lock free single
+*   producer / single consumer rings, one per direction. The socket is then
+*   only used as a doorbell to wake up a sleeping reader, and to notice when
+*   the other side goes away. The framing on top of it does not change.
+******************************************************************************/
+int transport_read(int fd, char* buffer, int length);
+int transport_read_frame(int fd, char* msg); // never blocks, see .cpp
+int transport_write(int fd, const char* buffer, int length);
+bool transport_pending(int fd);
+bool transport_readable(int fd);
+short transport_events(int fd, int& timeout);
+void transport_close(int fd);
+void transport_reset();
+bool isLocalSocket(int fd);
+bool isSocketPath(const char* host);
+
+// shared memory negotiation ~ see protocol.txt
+int shm_offer(int fd);  // server side: create the region and send it over
+int shm_accept(int fd); // client side: receive the region and attach to it
+
+// outbound queues, so a slow peer can't block the server. The event loop
+// flushes them before it sleeps
+void transport_queue_writes(int fd);
+int transport_flush(int fd);
+bool transport_failed(int fd);
+bool transport_congested(int fd);
+size_t transport_backlog(int fd);
+
+// handing a server side connection over to another process
+int transport_shm_fd(int fd);
+int transport_adopt_shm(int fd, int memFD);
+void transport_buffered(int fd, std::string& in, std::string& out);
+void transport_adopt_buffered(int fd, const std::string& in,
+                              const std::string& out);
+
+#endif
@@ -0,0 +1,248 @@
+/******************************************************************************
+* Program:
+*    transport_test - moves bytes through a connection's transport
+* Summary:
+*    Both ends of a socketpair live in this process: one is the server's
+*    side, the other the client's. Each case checks what the reading end
+*    gets out of what the writing end put in, through the socket or through
+*    the shared memory rings the pair negotiated.
+******************************************************************************/
+#include <cstdio>   // printf
+#include <cstring>  // strcmp
+#include <string>
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/socket.h> // socketpair, send
+#include <unistd.h> // close
+
+#include "constants.h" // ERROR_BAD, MAXLEN
+#include "transport.h"
+
+using namespace std;
+
+const int RING_SIZE = 64 * 1024;       // SHM_RING_SIZE of transport.cpp
+const int HARD_LIMIT = 256 * 1024;     // OUT_HARD_LIMIT of transport.cpp
+const int HIGH_WATERMARK = 16 * 1024;  // OUT_HIGH_WATERMARK of transport.cpp
+
+/******************************************************************************
+* check() - reports a check of a case
+******************************************************************************/
+static bool check(const char* what, bool passed)
+{
+   printf("%-52s %s\n", what, passed ? "ok" : "FAILED");
+   return passed;
+}
+
+/******************************************************************************
+* pattern() - count bytes nobody would mistake for another stretch of them
+******************************************************************************/
+static string pattern(int count, int seed)
+{
+   string bytes(count, '\0');
+   for (int i = 0; i < count; i++)
+      bytes[i] = (char)((i * 7 + seed * 13) & 0xff);
+   return bytes;
+}
+
+/******************************************************************************
+* readAll() - reads exactly count bytes off the fd
+******************************************************************************/
+static string readAll(int fd, int count)
+{
+   string bytes;
+   char buffer[4096];
+   while ((int)bytes.size() < count)
+   {
+      int want = count - bytes.size();
+      int got = transport_read(fd, buffer, want < 4096 ? want : 4096);
+      if (got <= 0)
+         break;
+      bytes.append(buffer, got);
+   }
+   return bytes;
+}
+
+/******************************************************************************
+* shmPair() - a socketpair whose ends (server, client) talk through shared
+*             memory. Returns false if they could not set it up.
+******************************************************************************/
+static bool shmPair(int& server, int& client)
+{
+   int fds[2];
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+      return false;
+   server = fds[0];
+   client = fds[1];
+   return shm_offer(server) != ERROR_BAD && shm_accept(client) != ERROR_BAD;
+}
+
+/******************************************************************************
+* closePair() - drops the transport of both ends, then the sockets
+******************************************************************************/
+static void closePair(int a, int b)
+{
+   transport_close(a);
+   transport_close(b);
+   close(a);
+   close(b);
+}
+
+/******************************************************************************
+* testWraparound() - more than a ring's worth of bytes, in chunks that don't
+*                    divide its size, come out in order as they went in.
+*                    A full ring takes what fits, and the rest when the
+*                    reader made room.
+******************************************************************************/
+static bool testWraparound()
+{
+   int server, client;
+   bool passed = check("wraparound: the ends negotiate shared memory",
+                       shmPair(server, client));
+   if (!passed)
+      return false;
+
+   bool same = true;
+   for (int chunk = 0; chunk < 8; chunk++)
+   {
+      string bytes = pattern(40000, chunk); // 320000 bytes, 4+ laps
+      same &= (transport_write(server, bytes.data(), bytes.size()) ==
+               (int)bytes.size());
+      same &= (readAll(client, bytes.size()) == bytes);
+   }
+   passed &= check("wraparound: laps of the ring come out in order", same);
+
+   // the client's writes are queued, so they stop at a full ring
+   transport_queue_writes(client);
+   string bytes = pattern(RING_SIZE + 1000, 99);
+   transport_write(client, bytes.data(), bytes.size());
+   transport_flush(client);
+   passed &= check("wraparound: a full ring takes what fits",
+                   transport_backlog(client) == 1000);
+   string first = readAll(server, RING_SIZE);
+   transport_flush(client);
+   passed &= check("wraparound: the rest once the reader made room",
+                   transport_backlog(client) == 0 &&
+                   first + readAll(server, 1000) == bytes);
+
+   closePair(server, client);
+   return passed;
+}
+
+/******************************************************************************
+* testTampered() - the other side can write anything into the region. A head
+*                  no writer could have reached breaks the channel: the
+*                  reader sees a hung up peer, not bytes off the ring.
+******************************************************************************/
+static bool testTampered()
+{
+   int server, client;
+   if (!shmPair(server, client))
+      return check("tampered: the ends negotiate shared memory", false);
+
+   // the region starts with the head of the ring to the client
+   void* region = mmap(NULL, RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       transport_shm_fd(server), 0);
+   bool passed = check("tampered: the region maps", region != MAP_FAILED);
+   if (passed)
+   {
+      *(volatile unsigned*)region = RING_SIZE + 1;
+      char msg[MAXLEN];
+      passed &= check("tampered: a head past the ring breaks it",
+                      transport_read_frame(client, msg) == ERROR_BAD);
+      passed &= check("tampered: and it stays broken",
+                      transport_write(client, "x", 1) == ERROR_BAD);
+      munmap(region, RING_SIZE);
+   }
+
+   closePair(server, client);
+   return passed;
+}
+
+/******************************************************************************
+* testPartialFrame() - a frame that arrives in pieces is handed out whole,
+*                      once its last byte is in: the length byte alone, or
+*                      half the message, is not a frame yet
+******************************************************************************/
+static bool testPartialFrame()
+{
+   int fds[2];
+   socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+   // frame: 1 byte with the length, then the message and its '\0'
+   const char frames[] = "\006hello\0\003ok\0\005tail";
+   char msg[MAXLEN];
+
+   send(fds[0], frames, 1, 0);
+   bool passed = check("partial frame: the length byte alone is not one",
+                       transport_read_frame(fds[1], msg) == 0);
+   send(fds[0], frames + 1, 3, 0);
+   passed &= check("partial frame: half the message is not one",
+                   transport_read_frame(fds[1], msg) == 0);
+   send(fds[0], frames + 4, 12, 0); // its end, a frame, a piece of a 3rd
+   passed &= check("partial frame: whole once the rest came in",
+                   transport_read_frame(fds[1], msg) == 6 &&
+                   strcmp(msg, "hello") == 0);
+   passed &= check("partial frame: the next one came in the same read",
+                   transport_read_frame(fds[1], msg) == 3 &&
+                   strcmp(msg, "ok") == 0);
+   passed &= check("partial frame: the piece of the 3rd waits",
+                   transport_read_frame(fds[1], msg) == 0);
+   send(fds[0], "\0", 1, 0);
+   passed &= check("partial frame: and comes out whole too",
+                   transport_read_frame(fds[1], msg) == 5 &&
+                   strcmp(msg, "tail") == 0);
+
+   send(fds[0], "\004cu", 3, 0);
+   close(fds[0]);
+   passed &= check("partial frame: a hang up drops the cut one",
+                   transport_read_frame(fds[1], msg) == ERROR_BAD);
+
+   transport_close(fds[1]);
+   close(fds[1]);
+   return passed;
+}
+
+/******************************************************************************
+* testQueue() - a queue over the high watermark is congested. One that
+*               would grow past the hard limit fails the peer, and the
+*               write that would have done it is not queued.
+******************************************************************************/
+static bool testQueue()
+{
+   int fds[2];
+   socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+   transport_queue_writes(fds[0]);
+
+   string bytes = pattern(HIGH_WATERMARK + 1, 1);
+   transport_write(fds[0], bytes.data(), bytes.size());
+   bool passed = check("queue: congested over the high watermark",
+                       transport_congested(fds[0]) &&
+                       !transport_failed(fds[0]));
+
+   bytes = pattern(HARD_LIMIT - bytes.size(), 2);
+   passed &= check("queue: up to the hard limit is queued",
+                   transport_write(fds[0], bytes.data(), bytes.size()) ==
+                   (int)bytes.size() && !transport_failed(fds[0]) &&
+                   transport_backlog(fds[0]) == (size_t)HARD_LIMIT);
+   passed &= check("queue: a byte past it fails the peer",
+                   transport_write(fds[0], "x", 1) == ERROR_BAD &&
+                   transport_failed(fds[0]) &&
+                   transport_backlog(fds[0]) == (size_t)HARD_LIMIT);
+   passed &= check("queue: a failed peer takes nothing more",
+                   transport_write(fds[0], "", 0) == ERROR_BAD &&
+                   transport_flush(fds[0]) == ERROR_BAD);
+
+   closePair(fds[0], fds[1]);
+   return passed;
+}
+
+/******************************************************************************
+* main - the transport's rings, frames and queues
+******************************************************************************/
+int main()
+{
+   bool passed = true;
+   passed &= testWraparound();
+   passed &= testTampered();
+   passed &= testPartialFrame();
+   passed &= testQueue();
+   return (passed ? 0 : 1);
+}
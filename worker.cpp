@@ -0,0 +1,330 @@
+#include <cerrno>   // errno
+#include <cstring>  // memset, memcpy, strcpy
+#include <string>
+#include <poll.h>   // poll
+#include <sys/socket.h> // sendmsg, recvmsg
+#include <unistd.h> // close
+#include "capture.h"
+#include "constants.h" // PING_INTERVAL
+#include "logger.h"
+#include "transport.h"
+#include "worker.h"
+
+using namespace std;
+
+const int MAX_HANDOFF_FDS = 4; // a socket and a shared memory per player
+
+/******************************************************************************
+* Worker constructor
+******************************************************************************/
+Worker::Worker(int controlFD) : controlFD(controlFD), lastResult(NO_CONTEST)
+{
+}
+
+/******************************************************************************
+* Worker destructor - ends whatever is still running
+******************************************************************************/
+Worker::~Worker()
+{
+   for (vector<Match*>::iterator it = matches.begin();
+        it != matches.end(); ++it)
+      delete *it;
+
+   if (controlFD != ERROR_BAD)
+      close(controlFD);
+}
+
+/******************************************************************************
+* add() - starts the match and keeps it running
+******************************************************************************/
+void Worker::add(Match* match)
+{
+   matches.push_back(match);
+   match->start();
+}
+
+/******************************************************************************
+* run() - the event loop. Polls the control socket for new matches, and the
+*         players of every match for their inputs. A shared memory player
+*         that already has data waiting makes the poll() return right away.
+******************************************************************************/
+void Worker::run()
+{
+   while (controlFD != ERROR_BAD || !matches.empty())
+   {
+      vector<struct pollfd> fds;
+      vector<Match*> owners;  // the match of each fd, NULL for the control
+      int timeout = -1;
+
+      struct pollfd pfd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if (controlFD != ERROR_BAD)
+      {
+         pfd.fd = controlFD;
+         fds.push_back(pfd);
+         owners.push_back(NULL);
+      }
+
+      for (size_t i = 0; i < matches.size(); i++)
+      {
+         vector<int> matchFDs;
+         matches[i]->getFDs(matchFDs);
+         for (size_t j = 0; j < matchFDs.size(); j++)
+         {
+            // send what the last events queued before going to sleep
+            transport_flush(matchFDs[j]);
+            pfd.fd = matchFDs[j];
+            pfd.events = transport_events(matchFDs[j], timeout);
+            fds.push_back(pfd);
+            owners.push_back(matches[i]);
+         }
+      }
+
+      // wake up now and then to probe the waiting players' round trips
+      if (!matches.empty() &&
+          (timeout < 0 || timeout > PING_INTERVAL * 1000))
+         timeout = PING_INTERVAL * 1000;
+
+      // the capture's records too, if the server is capturing
+      capture_flush();
+      if (poll(&fds[0], fds.size(), timeout) < 0)
+         continue; // EINTR
+
+      for (size_t i = 0; i < fds.size(); i++)
+      {
+         int fd = fds[i].fd;
+         if (!owners[i])
+         {
+            if (fds[i].revents)
+               receiveMatch();
+            continue;
+         }
+
+         if (fds[i].revents & (POLLOUT | POLLHUP | POLLERR))
+            transport_flush(fd);
+
+         // a readable socket, or shared memory that already has data
+         bool readable = (fds[i].events & POLLIN) &&
+            (fds[i].revents & (POLLIN | POLLHUP | POLLERR) ?
+             transport_readable(fd) : transport_pending(fd));
+         if (!owners[i]->isOver() && readable)
+            owners[i]->onReadable(fd);
+      }
+
+      for (size_t i = 0; i < matches.size(); i++)
+      {
+         matches[i]->probe();
+         matches[i]->checkPeers();
+      }
+
+      // let go of the matches that are over
+      for (size_t i = 0; i < matches.size(); )
+      {
+         if (matches[i]->isOver())
+         {
+            reportMatch(matches[i]);
+            delete matches[i];
+            matches.erase(matches.begin() + i);
+         }
+         else
+            i++;
+      }
+   }
+}
+
+/******************************************************************************
+* receiveMatch() - reads a MatchHandoff from the lobby, and starts the match.
+*                  If the lobby is gone, stop taking new matches.
+******************************************************************************/
+void Worker::receiveMatch()
+{
+   // the size of the whole message first, for the bytes after the handoff
+   char probe;
+   ssize_t total = recv(controlFD, &probe, sizeof(probe),
+                        MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+   if (total < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+
+   MatchHandoff handoff;
+   memset(&handoff, 0, sizeof(handoff));
+   string buffered(total > (ssize_t)sizeof(handoff) ?
+                   total - sizeof(handoff) : 0, '\0');
+   struct iovec iov[2];
+   iov[0].iov_base = &handoff;
+   iov[0].iov_len = sizeof(handoff);
+   iov[1].iov_base = &buffered[0];
+   iov[1].iov_len = buffered.size();
+
+   union
+   {
+      struct cmsghdr align;
+      char buffer[CMSG_SPACE(MAX_HANDOFF_FDS * sizeof(int))];
+   } control;
+
+   struct msghdr header;
+   memset(&header, 0, sizeof(header));
+   header.msg_iov = iov;
+   header.msg_iovlen = (buffered.empty() ? 1 : 2);
+   header.msg_control = control.buffer;
+   header.msg_controllen = sizeof(control.buffer);
+
+   ssize_t size = (total <= 0 ? total :
+                   recvmsg(controlFD, &header, MSG_CMSG_CLOEXEC));
+   if (size <= 0)
+   {
+      LOG_WARN("Lost the lobby, finishing the running games");
+      close(controlFD);
+      controlFD = ERROR_BAD;
+      return;
+   }
+
+   int passed[MAX_HANDOFF_FDS];
+   int count = 0;
+   struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+   if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+   {
+      count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(passed, CMSG_DATA(cmsg), count * sizeof(int));
+   }
+
+   // the fds come in order: each human player's socket, then its shared
+   // memory if it has one
+   size_t expected = sizeof(handoff);
+   for (int i = 0; i < 2; i++)
+      expected += (size_t)handoff.inSizes[i] + handoff.outSizes[i];
+
+   Player* players[2];
+   int next = 0;
+   size_t offset = 0;
+   for (int i = 0; i < 2; i++)
+   {
+      players[i] = new Player(ERROR_BAD, handoff.names[i], handoff.isBot[i]);
+
+      if (!handoff.isBot[i] && next < count)
+      {
+         players[i]->clientFD = passed[next++];
+         capture_adopt(players[i]->clientFD, handoff.captureIDs[i]);
+      }
+      if (handoff.hasShm[i] && next < count)
+         transport_adopt_shm(players[i]->clientFD, passed[next++]);
+
+      // what the lobby read from the player, and owed it
+      if ((size_t)size == expected)
+      {
+         string in = buffered.substr(offset, handoff.inSizes[i]);
+         offset += handoff.inSizes[i];
+         string out = buffered.substr(offset, handoff.outSizes[i]);
+         offset += handoff.outSizes[i];
+         transport_adopt_buffered(players[i]->clientFD, in, out);
+      }
+   }
+
+   if ((size_t)size != expected || next != count ||
+       (!players[0]->isBot && players[0]->clientFD == ERROR_BAD) ||
+       (!players[1]->isBot && players[1]->clientFD == ERROR_BAD))
+   {
+      LOG_ERROR("Bad handoff from the lobby, dropping it");
+      for (int i = 0; i < count; i++)
+      {
+         transport_close(passed[i]);
+         close(passed[i]);
+      }
+      delete players[0];
+      delete players[1];
+      return;
+   }
+
+   add(new Match(players[0], players[1]));
+}
+
+/******************************************************************************
+* reportMatch() - lets the lobby know the match is over, and how it ended
+******************************************************************************/
+void Worker::reportMatch(const Match* match)
+{
+   lastResult = match->getResult();
+   if (controlFD == ERROR_BAD)
+      return;
+
+   MatchReport report;
+   memset(&report, 0, sizeof(report));
+   strcpy(report.names[0], match->getPlayer(0)->name);
+   strcpy(report.names[1], match->getPlayer(1)->name);
+   report.isBot[0] = match->getPlayer(0)->isBot;
+   report.isBot[1] = match->getPlayer(1)->isBot;
+   report.result = lastResult;
+   send(controlFD, &report, sizeof(report), MSG_NOSIGNAL);
+}
+
+/******************************************************************************
+* sendMatch() - lobby side: hands the pair over to the worker on the other
+*               end of controlFD, with whatever the lobby read from them
+*               and did not handle, and still owed them. The lobby's copies
+*               of the fds can be closed once this returns ERROR_OK.
+******************************************************************************/
+int sendMatch(int controlFD, const Player* p1, const Player* p2)
+{
+   const Player* players[2] = { p1, p2 };
+   MatchHandoff handoff;
+   int passed[MAX_HANDOFF_FDS];
+   int count = 0;
+   string buffered; // the bytes after the handoff
+
+   memset(&handoff, 0, sizeof(handoff));
+   for (int i = 0; i < 2; i++)
+   {
+      strcpy(handoff.names[i], players[i]->name);
+      handoff.isBot[i] = players[i]->isBot;
+      if (players[i]->isBot)
+         continue;
+
+      passed[count++] = players[i]->clientFD;
+      handoff.captureIDs[i] = capture_id(players[i]->clientFD);
+      int memFD = transport_shm_fd(players[i]->clientFD);
+      if (memFD != ERROR_BAD)
+      {
+         handoff.hasShm[i] = true;
+         passed[count++] = memFD;
+      }
+
+      string in, out;
+      transport_buffered(players[i]->clientFD, in, out);
+      handoff.inSizes[i] = in.size();
+      handoff.outSizes[i] = out.size();
+      buffered += in;
+      buffered += out;
+   }
+
+   struct iovec iov[2];
+   iov[0].iov_base = &handoff;
+   iov[0].iov_len = sizeof(handoff);
+   iov[1].iov_base = (void*)buffered.data();
+   iov[1].iov_len = buffered.size();
+
+   union
+   {
+      struct cmsghdr align;
+      char buffer[CMSG_SPACE(MAX_HANDOFF_FDS * sizeof(int))];
+   } control;
+
+   struct msghdr header;
+   memset(&header, 0, sizeof(header));
+   header.msg_iov = iov;
+   header.msg_iovlen = (buffered.empty() ? 1 : 2);
+   if (count)
+   {
+      header.msg_control = control.buffer;
+      header.msg_controllen = CMSG_SPACE(count * sizeof(int));
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+      memcpy(CMSG_DATA(cmsg), passed, count * sizeof(int));
+   }
+
+   if (sendmsg(controlFD, &header, MSG_NOSIGNAL) !=
+       (ssize_t)(sizeof(handoff) + buffered.size()))
+      return ERROR_BAD;
+   return ERROR_OK;
+}
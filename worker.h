@@ -0,0 +1,63 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <vector>
+#include "constants.h"
+#include "match.h"
+
+/******************************************************************************
+* Worker Class - runs any number of matches in one process, polling the
+*   sockets of all their players. In cluster mode the lobby (the Server)
+*   passes the sockets of each matched pair to a worker over its control
+*   socket (SCM_RIGHTS), and the worker reports back every match that ends.
+*   Without a control socket, it runs the matches it was given and returns.
+******************************************************************************/
+class Worker
+{
+   public:
+      Worker(int controlFD = ERROR_BAD);
+      ~Worker();
+      void add(Match* match); // starts the match, the worker deletes it
+      void run(); // until the lobby goes away and every match is over
+      int getLastResult() const { return lastResult; }
+
+   private:
+      int controlFD; // the lobby's end is in the Server, -1 if there is none
+      std::vector<Match*> matches;
+      int lastResult; // of the last match that ended, NO_CONTEST if none
+
+      void receiveMatch();
+      void reportMatch(const Match* match);
+};
+
+/******************************************************************************
+* the messages on the control socket
+******************************************************************************/
+// lobby -> worker, along with the players' sockets (and shared memory).
+// What the lobby still held for them follows it in the same message:
+// player 1's input then output, then player 2's (transport_buffered()).
+struct MatchHandoff
+{
+   char names[2][MAXLEN];
+   bool isBot[2];
+   bool hasShm[2];
+   int captureIDs[2]; // capture_id() of each player's connection
+   unsigned inSizes[2];  // bytes read from the player, not handled yet
+   unsigned outSizes[2]; // bytes queued for the player, not sent yet
+};
+
+// the control socket's send buffer, so a handoff with every byte a lobby
+// may hold for two players fits
+const int CONTROL_BUFFER = 512 * 1024;
+
+// worker -> lobby, when a match is over
+struct MatchReport
+{
+   char names[2][MAXLEN];
+   bool isBot[2];
+   int result; // Match::getResult()
+};
+
+int sendMatch(int controlFD, const Player* p1, const Player* p2);
+
+#endif